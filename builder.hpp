@@ -1,44 +1,67 @@
 #pragma once
 #include <_main.hpp>
+#include <cstring>
 #include "coord.hpp"
 #include "grid.hpp"
+#include "noise.hpp"
 #include "tile.hpp"
 
-grid replace_coords(grid grid, vector<plane_coord> coords,
-                    tile::idents symbol) {
-    for (auto &&c : coords) {
-        grid[c] = symbol;
-    }
+grid random_grid(random_gen &rand, sig size) {
+    auto grid = ::grid(size, tile::idents::wall);
+    for (sig y = 1; y < size - 1; y++)
+        ROOM_TILE_SAMPLER.fill(rand, &grid.raw_row(y)[1], size_t(size - 2));
     return grid;
 }
 
-grid random_grid(random_gen &rand, sig _size,
-                 map<tile::idents, tile> const &tiles) {
-    using ti = tile::idents;
-    auto size = static_cast<size_t>(_size);
+/**
+ * Room terrain of `size` cells, walled along the border. The generators take
+ * everything they need from `rand`, so build_room() stays deterministic
+ * whichever one it uses.
+ */
+using terrain_generator = grid (*)(random_gen &rand, sig size);
 
-    vector<double> tile_weights;
-    for (auto &[t, w] : ROOM_TILE_WEIGHTS)
-        tile_weights.push_back(w);
-    discrete_distribution<size_t> dist(begin(tile_weights), end(tile_weights));
+/// Tiles drawn one by one from ROOM_TILE_WEIGHTS.
+grid scattered_terrain(random_gen &rand, sig size) {
+    return random_grid(rand, size);
+}
 
-    vector<vector<ti>> grid(size, vector<ti>(0));
-    grid[0] = grid.back() = vector<ti>(size, ti::wall);
-    for (auto i_row : nums(1_s, size - 1)) {
-        grid[i_row].push_back(ti::wall);
-        for (auto i_col : nums(1_s, size - 1)) {
-            grid[i_row].push_back(ROOM_TILE_WEIGHTS[dist(rand)].first);
-        }
-        grid[i_row].push_back(ti::wall);
-    }
+/// Fills the cells of [x0,x0+w)x[y0,y0+h) of a freshly built `grid` from
+/// `noise`, with (x0,y0) at room coordinates (rx,ry).
+void fill_noise(grid &grid, noise_terrain const &noise, sig x0, sig y0,
+                sig w, sig h, sig rx, sig ry) {
+    for (auto y = y0; y < y0 + h; y++)
+        noise.fill_row(int32_t(rx), int32_t(ry + y - y0), size_t(w),
+                       &grid.raw_row(y)[x0]);
+}
+
+/// Tiles in patches and clusters, from a noise_terrain seeded by `rand`.
+grid noise_terrain_grid(random_gen &rand, sig size) {
+    auto noise = noise_terrain(uint32_t(rand()));
+    auto grid = ::grid(size, tile::idents::wall);
+    fill_noise(grid, noise, 1, 1, size - 2, size - 2, 1, 1);
     return grid;
 }
 
-grid empty_grid(sig size) {
-    return vector<vector<tile::idents>>(
-        size_t(size), vector<tile::idents>(size_t(size), tile::idents::nil));
+/**
+ * Chunk (cx,cy) of a room of `room_size` cells that is made of `chunk_size`
+ * chunks: terrain from `noise` at room coordinates, so that neighbouring
+ * chunks fit together, with walls along the border of the room and beyond
+ * it.
+ */
+grid noise_chunk(noise_terrain const &noise, sig chunk_size, sig room_size,
+                 sig cx, sig cy) {
+    auto grid = ::grid(chunk_size, tile::idents::wall);
+    auto x0 = cx * chunk_size, y0 = cy * chunk_size;
+    auto x = max(1 - x0, sig(0)), y = max(1 - y0, sig(0));
+    auto x1 = min(room_size - 1 - x0, chunk_size),
+         y1 = min(room_size - 1 - y0, chunk_size);
+    if (x < x1 && y < y1)
+        fill_noise(grid, noise, x, y, x1 - x, y1 - y, x0 + x, y0 + y);
+    return grid;
 }
 
+grid empty_grid(sig size) { return grid(size); }
+
 vector<wall_coord> random_wall_coords(random_gen &rand, sig count, sig max_u,
                                       sig min_u) {
     auto door_side = side::LEFT;
@@ -61,38 +84,235 @@ vector<plane_coord> random_plane_coords(random_gen &rand, sig count, sig max_xy,
     return r;
 }
 
-pair<vector<plane_coord>, grid> add_random_doorways(random_gen &rand, grid grid,
-                                                    sig count) {
+vector<plane_coord> add_random_doorways(random_gen &rand, grid &grid,
+                                        sig count) {
     sig max_coord = grid.size() - 1;
     auto doors = to_plane_coords(
         random_wall_coords(rand, count, max_coord - 1, 1), max_coord, 0);
-    auto door_sigils = vector<plane_coord>();
-    transform(cbegin(doors), cend(doors), back_inserter(door_sigils),
-              [&max_coord](auto x) {
-                  if (x.x() == 0)
-                      ++x.x();
-                  else if (x.x() == max_coord)
-                      --x.x();
-                  if (x.y() == 0)
-                      ++x.y();
-                  else if (x.y() == max_coord)
-                      --x.y();
-                  return x;
-              });
-    auto grid1 = replace_coords(move(grid), doors, tile::idents::doorway);
-    auto grid2 =
-        replace_coords(move(grid1), door_sigils, tile::idents::doorway_sigil);
-    return {move(doors), move(grid2)};
-}
-
-pair<layers, vector<plane_coord>> build_room(random_gen &rand, sig grid_size) {
-    auto chest_coords = random_plane_coords(
-        rand, static_cast<sig>(rand.get(0, 2)), grid_size - 2, 1);
-    auto &&[door_coords, bottom_grid] =
-        add_random_doorways(rand, random_grid(rand, grid_size, ALL_TILES),
-                            static_cast<sig>(rand.get(2, 6)));
-    return {layers{replace_coords(move(bottom_grid), chest_coords,
-                                  tile::idents::chest),
-                   empty_grid(grid_size),empty_grid(grid_size)},
-            move(door_coords)};
+    grid.set(doors, tile::idents::doorway);
+    for (auto sigil : doors) {
+        if (sigil.x() == 0)
+            ++sigil.x();
+        else if (sigil.x() == max_coord)
+            --sigil.x();
+        if (sigil.y() == 0)
+            ++sigil.y();
+        else if (sigil.y() == max_coord)
+            --sigil.y();
+        grid[sigil] = tile::idents::doorway_sigil;
+    }
+    return doors;
+}
+
+/// Room edge length for a window of `window_size` font cells.
+sig random_room_size(random_gen &rand, int window_size) {
+    return sig(rand.get(window_size / 4, window_size / 3) + 5);
+}
+
+/// By byte value: 1 for the tiles with the passable flag, 0 for all others.
+array<uint64_t, 256> const PASSABLE_BIT = [] {
+    array<uint64_t, 256> r{};
+    for (auto i : nums(0_s, tile::ident_count))
+        r[i] = uint64_t(ALL_TILES[tile::idents(i)].flags &
+                        tile::flag_bits::passable);
+    return r;
+}();
+
+/**
+ * Bit c says whether cells[c] is passable, for up to 64 cells. Eight cells
+ * at a time are read as one (little-endian) word, turned into 0/1 bytes and
+ * gathered into eight bits by a multiplication.
+ */
+uint64_t passable_bits(tile::idents const *cells, sig n) {
+    auto bits = uint64_t(0), c = uint64_t(0);
+    for (; sig(c) + 8 <= n; c += 8) {
+        uint64_t word;
+        memcpy(&word, cells + c, 8);
+        auto byte = [word](int i) {
+            return PASSABLE_BIT[word >> 8 * i & 0xff] << 8 * i;
+        };
+        auto bytes = byte(0) | byte(1) | byte(2) | byte(3) | byte(4) |
+                     byte(5) | byte(6) | byte(7);
+        bits |= bytes * 0x0102040810204080 >> 56 << c;
+    }
+    for (; sig(c) < n; c++)
+        bits |= PASSABLE_BIT[uint8_t(cells[c])] << c;
+    return bits;
+}
+
+/// Grows `seeds` along the runs of set bits of `mask` that contain them.
+uint64_t spread_along_runs(uint64_t seeds, uint64_t mask) {
+    auto up = seeds & mask, down = up, up_mask = mask, down_mask = mask;
+    for (auto shift = 1; shift < 64; shift *= 2) {
+        up |= up_mask & (up << shift), up_mask &= up_mask << shift;
+        down |= down_mask & (down >> shift), down_mask &= down_mask >> shift;
+    }
+    return up | down;
+}
+
+/// Buffers of reachable_cells(), kept so that repeated calls do not allocate.
+struct reach_scratch {
+    vector<uint64_t> passable, reach;
+    vector<char> pending;
+};
+
+/**
+ * Cells reachable from (x,y) over 4-connected passable tiles, laid out like
+ * grid::flag_row(); none if (x,y) is impassable. The result lives in
+ * `scratch` until the next call.
+ * Works on whole words of passable cells: a row takes the reachable cells of
+ * its neighbour rows and spreads them along its runs of passable cells.
+ * Rows are swept down and up while some row can still gain cells from a
+ * neighbour.
+ */
+vector<uint64_t> const &reachable_cells(grid const &grid, sig x, sig y,
+                                        reach_scratch &scratch) {
+    auto const size = grid.size(), words = grid.words_per_row();
+    auto &passable = scratch.passable, &reach = scratch.reach;
+    passable.resize(size_t(size * words));
+    for (sig r = 0; r < size; r++) {
+        auto *row = grid.row(r).data();
+        for (sig w = 0; w < words; w++)
+            passable[size_t(r * words + w)] =
+                passable_bits(row + w * 64, min(size - w * 64, sig(64)));
+    }
+    reach.assign(passable.size(), 0);
+    auto start = size_t(y * words + x / 64);
+    reach[start] = passable[start] & uint64_t(1) << (x % 64);
+
+    auto &pending = scratch.pending;
+    pending.assign(size_t(size), false);
+    /// the rows next to (x,y) can grow from it even if its own row cannot
+    for (auto r = max(y - 1, sig(0)); r <= min(y + 1, size - 1); r++)
+        pending[size_t(r)] = true;
+    auto grow_row = [&](sig r) {
+        pending[size_t(r)] = false;
+        auto const above = -size_t(words), below = size_t(words);
+        for (auto again = true; again;) {
+            again = false;
+            for (sig w = 0; w < words; w++) {
+                auto i = size_t(r * words + w);
+                auto seeds = reach[i];
+                if (r > 0)
+                    seeds |= reach[i + above];
+                if (r + 1 < size)
+                    seeds |= reach[i + below];
+                if (w > 0)
+                    seeds |= reach[i - 1] >> 63;
+                if (w + 1 < words)
+                    seeds |= reach[i + 1] << 63;
+                auto gained = spread_along_runs(seeds, passable[i]) & ~reach[i];
+                if (!gained)
+                    continue;
+                reach[i] |= gained, again = words > 1;
+                /// a neighbour row only needs another look if it can grow
+                if (r > 0 && gained & passable[i + above] & ~reach[i + above])
+                    pending[size_t(r - 1)] = true;
+                if (r + 1 < size &&
+                    gained & passable[i + below] & ~reach[i + below])
+                    pending[size_t(r + 1)] = true;
+            }
+        }
+    };
+    for (auto any = true; any;) {
+        any = false;
+        for (sig r = 0; r < size; r++)
+            if (pending[size_t(r)])
+                grow_row(r), any = true;
+        for (sig r = size - 1; r >= 0; r--)
+            if (pending[size_t(r)])
+                grow_row(r), any = true;
+    }
+    return reach;
+}
+
+/// Where the player appears in a room that they did not enter through a
+/// door, as in the first room of a world.
+plane_coord room_spawn(sig size) {
+    return plane_coord(size / 2, size / 2, size - 1, 0);
+}
+
+/**
+ * Whether the player can get from `spawn` to every doorway and chest. A
+ * chest is reached by standing next to it. Since every doorway is reached,
+ * so is the tile next to it where a player entering through it appears.
+ */
+bool room_is_connected(grid const &grid, plane_coord const &spawn,
+                       cell_span<plane_coord const> doors,
+                       cell_span<plane_coord const> chests,
+                       reach_scratch &scratch) {
+    auto const size = grid.size(), words = grid.words_per_row();
+    auto &reach = reachable_cells(grid, spawn.x(), spawn.y(), scratch);
+    auto reached = [&](sig x, sig y) {
+        return x >= 0 && y >= 0 && x < size && y < size &&
+               (reach[size_t(y * words + x / 64)] >> (x % 64) & 1);
+    };
+    for (auto &d : doors)
+        if (!reached(d.x(), d.y()))
+            return false;
+    for (auto &c : chests) {
+        sig x = c.x(), y = c.y();
+        if (!reached(x - 1, y) && !reached(x + 1, y) && !reached(x, y - 1) &&
+            !reached(x, y + 1))
+            return false;
+    }
+    return true;
+}
+
+/// Rooms built by build_room() and the attempts it rejected, on all threads.
+struct generation_stats {
+    atomic<nat> rooms = 0, rejected = 0;
+    double rejection_rate() const {
+        auto attempts = rooms + rejected;
+        return attempts ? double(rejected) / double(attempts) : 0;
+    }
+};
+generation_stats room_generation;
+
+/**
+ * Builds a room on `terrain` in which every doorway and chest is reachable
+ * from the spawn. A room that fails room_is_connected() is rejected and
+ * built anew from the next random numbers, so the result still only
+ * depends on the state of `rand`.
+ */
+pair<layers, vector<plane_coord>>
+build_room(random_gen &rand, sig grid_size,
+           terrain_generator terrain = scattered_terrain) {
+    /// per thread, since the room pool builds rooms on several
+    thread_local reach_scratch scratch;
+    while (true) {
+        auto chest_coords = random_plane_coords(
+            rand, static_cast<sig>(rand.get(0, 2)), grid_size - 2, 1);
+        auto room = layers{terrain(rand, grid_size),
+                           empty_grid(grid_size), empty_grid(grid_size)};
+        auto door_count = static_cast<sig>(rand.get(2, 6));
+        auto door_coords = add_random_doorways(rand, room[0], door_count);
+        /// like the tiles inside doorways, the spawn is kept clear
+        auto spawn = room_spawn(grid_size);
+        room[0][spawn] = tile::idents::stone_flooring;
+        room[0].set(chest_coords, tile::idents::chest);
+        if (room_is_connected(room[0], spawn, door_coords, chest_coords,
+                              scratch)) {
+            room_generation.rooms++;
+            return {move(room), move(door_coords)};
+        }
+        room_generation.rejected++;
+    }
+}
+
+struct built_room {
+    random_gen rand; // state after generation, used for the room's events
+    sig size;
+    layers room;
+    vector<plane_coord> doors;
+};
+
+/// Generates room `room_id` of the world started with `seed`. Only depends
+/// on its arguments, so rooms can be built in any order and on any thread.
+built_room generate_room(random_device::result_type seed, sig room_id,
+                         int window_size) {
+    auto rand = random_gen(seed).split(nat(room_id));
+    auto size = random_room_size(rand, window_size);
+    auto &&[room, doors] = build_room(rand, size);
+    return {move(rand), size, move(room), move(doors)};
 }
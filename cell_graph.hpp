@@ -0,0 +1,78 @@
+#pragma once
+#include <_main.hpp>
+#include "grid.hpp"
+
+/**
+ * Implicit graph over the cells of a grid, for bfs, dfs and dijkstra.
+ * Vertex y * size + x is adjacent to each of its 4 (or, with diagonals, 8)
+ * neighbours that is passable according to `Passable(x, y)`; an impassable
+ * cell has no adjacencies. Nothing is materialized: neighbours are found
+ * when the traversal asks for them. deg() and head() keep the neighbours of
+ * the vertex they were last asked about, since dfs and dijkstra ask about
+ * the same vertex several times in a row; a graph is therefore not safe to
+ * share between threads.
+ */
+template <class Passable> class cell_graph {
+    static constexpr int OFFSETS[8][2] = {{1, 0},  {0, 1},  {-1, 0},
+                                          {0, -1}, {1, 1},  {-1, 1},
+                                          {-1, -1}, {1, -1}};
+  public:
+    /// The passable neighbours of a vertex.
+    struct neighbours {
+        array<int, 8> v;
+        int n = 0;
+        int const *begin() const { return v.data(); }
+        int const *end() const { return v.data() + n; }
+        int size() const { return n; }
+    };
+
+  private:
+    grid const &grid_;
+    Passable passable_;
+    int directions_;
+    mutable int cached_vertex_ = -1;
+    mutable neighbours cached_;
+
+    neighbours const &cached_adj(int u) const {
+        if (u != cached_vertex_)
+            cached_ = adj(u), cached_vertex_ = u;
+        return cached_;
+    }
+
+  public:
+    cell_graph(grid const &grid, Passable passable, bool diagonal = false)
+        : grid_(grid), passable_(move(passable)),
+          directions_(diagonal ? 8 : 4) {}
+
+    int order() const { return int(grid_.size() * grid_.size()); }
+    int vertex(sig x, sig y) const { return int(y * grid_.size() + x); }
+    sig x(int u) const { return u % grid_.size(); }
+    sig y(int u) const { return u / grid_.size(); }
+
+    neighbours adj(int u) const {
+        neighbours r;
+        auto ux = x(u), uy = y(u), size = grid_.size();
+        if (!passable_(ux, uy))
+            return r;
+        for (auto d = 0; d < directions_; d++) {
+            auto vx = ux + OFFSETS[d][0], vy = uy + OFFSETS[d][1];
+            if (vx >= 0 && vy >= 0 && vx < size && vy < size &&
+                passable_(vx, vy))
+                r.v[size_t(r.n++)] = vertex(vx, vy);
+        }
+        return r;
+    }
+    int deg(int u) const { return cached_adj(u).size(); }
+    int head(int u, int k) const { return cached_adj(u).v[size_t(k)]; }
+    int weight(int, int) const { return 1; }
+};
+
+/// Passability predicate for cell_graph: tiles with the passable flag, read
+/// from the grid's passable bitplane.
+auto passable_tiles(grid const &grid) {
+    return [&grid](sig x, sig y) {
+        return bool(grid.flag_row(tile::flag_bits::passable, y)[x / 64] >>
+                        (x % 64) &
+                    1);
+    };
+}
@@ -0,0 +1,79 @@
+#pragma once
+#include <_main.hpp>
+#include "coord.hpp"
+
+/**
+ * Spatial index of entities on a square room, at most one per cell.
+ * Every cell holds the slot of its entity in a packed entry array, so point
+ * lookups, insertions and erasures take constant time.
+ *
+ * Erasing moves the last entry into the freed slot, so iteration order is
+ * unspecified.
+ */
+template <class T> class cell_map {
+    sig size_;
+    vector<int32_t> slot_; // entry per cell, -1 if there is none
+    vector<pair<plane_coord, T>> entries_;
+
+    size_t cell(sig x, sig y) const { return size_t(y * size_ + x); }
+    bool inside(sig x, sig y) const {
+        return x >= 0 && y >= 0 && x < size_ && y < size_;
+    }
+
+  public:
+    explicit cell_map(sig size)
+        : size_(size), slot_(size_t(size * size), -1) {}
+
+    T *find(sig x, sig y) {
+        if (!inside(x, y) || slot_[cell(x, y)] < 0)
+            return nullptr;
+        return &entries_[size_t(slot_[cell(x, y)])].second;
+    }
+    T const *find(sig x, sig y) const {
+        return const_cast<cell_map *>(this)->find(x, y);
+    }
+    T *find(plane_coord const &p) { return find(p.x(), p.y()); }
+    T const *find(plane_coord const &p) const { return find(p.x(), p.y()); }
+    bool count(plane_coord const &p) const { return find(p); }
+
+    /// Checked access, terminates if there is no entity at `p`.
+    T &at(plane_coord const &p) {
+        if (auto *r = find(p))
+            return *r;
+        cerr << "cell_map: no entry at " << p << "\n";
+        terminate();
+    }
+    T const &at(plane_coord const &p) const {
+        return const_cast<cell_map *>(this)->at(p);
+    }
+    /// Returns the entity at `p`, inserting a default one if necessary.
+    T &operator[](plane_coord const &p) {
+        if (auto *r = find(p))
+            return *r;
+        slot_[cell(p.x(), p.y())] = int32_t(entries_.size());
+        entries_.push_back({p, T{}});
+        return entries_.back().second;
+    }
+
+    void erase(plane_coord const &p) {
+        if (!find(p))
+            return;
+        auto &freed = slot_[cell(p.x(), p.y())];
+        auto &last = entries_.back();
+        if (&entries_[size_t(freed)] != &last) {
+            slot_[cell(last.first.x(), last.first.y())] = freed;
+            entries_[size_t(freed)] = move(last);
+        }
+        entries_.pop_back();
+        freed = -1;
+    }
+
+    auto begin() const { return entries_.begin(); }
+    auto end() const { return entries_.end(); }
+    size_t size() const { return entries_.size(); }
+    bool empty() const { return entries_.empty(); }
+    size_t memory_footprint() const {
+        return slot_.capacity() * sizeof(int32_t) +
+               entries_.capacity() * sizeof(pair<plane_coord, T>);
+    }
+};
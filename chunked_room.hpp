@@ -0,0 +1,256 @@
+#pragma once
+#include <_main.hpp>
+#include "builder.hpp"
+#include "grid.hpp"
+#include "noise.hpp"
+#include "simulation.hpp"
+#include "tile.hpp"
+
+/// Edge length of the chunks of a chunked_room
+sig const CHUNK_SIZE = 64;
+/// Edge length of the window around the player that the flow field of a
+/// chunked_room covers, and cells of its sweep per tick: a sweep takes as
+/// many ticks as on a room of one chunk
+sig const FIELD_SIZE = 2 * CHUNK_SIZE;
+sig const FIELD_CELLS_PER_TICK = FLOW_FIELD_CELLS_PER_TICK *
+                                 (FIELD_SIZE / CHUNK_SIZE) *
+                                 (FIELD_SIZE / CHUNK_SIZE);
+
+/**
+ * Room of any size, stored as CHUNK_SIZE x CHUNK_SIZE chunks. A chunk is
+ * generated when it is first touched: its terrain comes from noise over the
+ * whole room, so it continues across chunk borders, and its events from a
+ * seed of its own, so chunks can be generated in any order.
+ *
+ * Every chunk keeps its own hazards and timers, but the chunks near the
+ * player are simulated together in room coordinates: projectiles fly from
+ * chunk to chunk, and traps aim along a single flow field over a window
+ * around the player, so the seams do not show in play.
+ *
+ * A chunk that is dropped is generated identically when it is needed
+ * again, except that the cells in which a changed chunk's terrain differs
+ * from the generated one are kept and restored. What is kept thus grows
+ * with the cells the player changed, not with the chunks visited.
+ */
+class chunked_room {
+  public:
+    struct chunk {
+        sig x, y;             // room coordinates of the top left cell
+        room_state state;     // in chunk coordinates
+        bool changed = false; // terrain differs from the generated one
+    };
+    /// A cell of a dropped chunk, as y * CHUNK_SIZE + x, and its tile.
+    using terrain_change = pair<uint16_t, tile::idents>;
+
+  private:
+    random_device::result_type seed_;
+    noise_terrain noise_;
+    sig size_, chunks_per_row_;
+    map<sig, chunk> chunks_; // by index cy * chunks_per_row_ + cx
+    map<sig, vector<terrain_change>> changes_; // of dropped changed chunks
+    projectiles moving_objects_; // of all chunks, in room coordinates
+    flow_field distances_;       // from the player
+    grid field_terrain_;         // under the window distances_ sweeps
+    pair<sig, sig> field_origin_{};
+
+    sig index(sig x, sig y) const {
+        return y / CHUNK_SIZE * chunks_per_row_ + x / CHUNK_SIZE;
+    }
+    grid generated_terrain(sig i) const {
+        return noise_chunk(noise_, CHUNK_SIZE, size_, i % chunks_per_row_,
+                           i / chunks_per_row_);
+    }
+
+    /// Copies the terrain under the field window from the chunks, with
+    /// walls beyond the room (as beyond its border inside a chunk).
+    void copy_field_terrain() {
+        auto [x0, y0] = field_origin_;
+        auto x1 = x0 + FIELD_SIZE, y1 = y0 + FIELD_SIZE;
+        for (auto cy = y0 / CHUNK_SIZE; cy * CHUNK_SIZE < y1; cy++)
+            for (auto cx = x0 / CHUNK_SIZE; cx * CHUNK_SIZE < x1; cx++) {
+                auto *c = cx < chunks_per_row_ && cy < chunks_per_row_
+                              ? &at(cx * CHUNK_SIZE, cy * CHUNK_SIZE)
+                              : nullptr;
+                for (auto y = max(y0, cy * CHUNK_SIZE);
+                     y < min(y1, cy * CHUNK_SIZE + CHUNK_SIZE); y++)
+                    for (auto x = max(x0, cx * CHUNK_SIZE);
+                         x < min(x1, cx * CHUNK_SIZE + CHUNK_SIZE); x++) {
+                        auto t = c ? c->state.room[0].cell(x - c->x, y - c->y)
+                                   : tile::idents::wall;
+                        if (field_terrain_.cell(x - x0, y - y0) != t)
+                            field_terrain_.set(x - x0, y - y0, t);
+                    }
+            }
+    }
+
+  public:
+    chunked_room(random_device::result_type seed, sig size)
+        : seed_(seed), noise_(uint32_t(seed)), size_(size),
+          chunks_per_row_((size + CHUNK_SIZE - 1) / CHUNK_SIZE),
+          distances_(FIELD_SIZE), field_terrain_(FIELD_SIZE) {}
+
+    sig size() const { return size_; }
+    size_t loaded() const { return chunks_.size(); }
+
+    /// The chunk that holds (x,y), generated if necessary.
+    chunk &at(sig x, sig y) {
+        auto i = index(x, y);
+        if (auto it = chunks_.find(i); it != chunks_.end())
+            return it->second;
+        auto cx = i % chunks_per_row_, cy = i / chunks_per_row_;
+        auto rand = random_gen(seed_).split(nat(i));
+        auto room = layers{generated_terrain(i), empty_grid(CHUNK_SIZE),
+                           empty_grid(CHUNK_SIZE)};
+        auto changed = false;
+        if (auto it = changes_.find(i); it != changes_.end()) {
+            for (auto [cell, t] : it->second)
+                room[0].raw_cell(cell % CHUNK_SIZE, cell / CHUNK_SIZE) = t;
+            changed = true;
+            changes_.erase(it);
+        }
+        auto &c = chunks_
+                      .emplace(i, chunk{cx * CHUNK_SIZE, cy * CHUNK_SIZE,
+                                        make_room_state(move(rand),
+                                                        move(room)),
+                                        changed})
+                      .first->second;
+        c.state.distances = flow_field(0); // the room's field is shared
+        return c;
+    }
+    bool has_flags(plane_coord const &p, sig flags) {
+        auto &c = at(p.x(), p.y());
+        return c.state.room[0].has_flags(sig(p.x()) - c.x, sig(p.y()) - c.y,
+                                         flags);
+    }
+    void set(size_t layer, plane_coord const &p, tile::idents t) {
+        auto &c = at(p.x(), p.y());
+        c.state.room[layer].set(sig(p.x()) - c.x, sig(p.y()) - c.y, t);
+    }
+
+    /// Generates every chunk that overlaps [x0,x1]x[y0,y1].
+    void load(sig x0, sig y0, sig x1, sig y1) {
+        x0 = max(x0, sig(0)), y0 = max(y0, sig(0));
+        x1 = min(x1, size_ - 1), y1 = min(y1, size_ - 1);
+        for (auto y = y0 / CHUNK_SIZE; y <= y1 / CHUNK_SIZE; y++)
+            for (auto x = x0 / CHUNK_SIZE; x <= x1 / CHUNK_SIZE; x++)
+                at(x * CHUNK_SIZE, y * CHUNK_SIZE);
+    }
+    /// Drops the chunks that do not overlap [x0,x1]x[y0,y1].
+    void evict_outside(sig x0, sig y0, sig x1, sig y1) {
+        for (auto it = chunks_.begin(); it != chunks_.end();) {
+            auto &c = it->second;
+            if (c.x + CHUNK_SIZE > x0 && c.x <= x1 && c.y + CHUNK_SIZE > y0 &&
+                c.y <= y1) {
+                ++it;
+                continue;
+            }
+            if (c.changed) {
+                auto generated = generated_terrain(it->first);
+                auto &terrain = c.state.room[0];
+                vector<terrain_change> diff;
+                for (sig y = 0; y < CHUNK_SIZE; y++)
+                    for (sig x = 0; x < CHUNK_SIZE; x++)
+                        if (terrain.cell(x, y) != generated.cell(x, y))
+                            diff.push_back({uint16_t(y * CHUNK_SIZE + x),
+                                            terrain.cell(x, y)});
+                if (!diff.empty())
+                    changes_.emplace(it->first, move(diff));
+            }
+            it = chunks_.erase(it);
+        }
+    }
+    /// The chunks as the cells of one room, for move_objects().
+    class cells {
+        chunked_room &room_;
+        chunk *last_ = nullptr;
+
+        chunk &at(sig x, sig y) {
+            if (!last_ || x < last_->x || y < last_->y ||
+                x >= last_->x + CHUNK_SIZE || y >= last_->y + CHUNK_SIZE)
+                last_ = &room_.at(x, y);
+            return *last_;
+        }
+
+        static room_cells chunk_cells(chunk &c) {
+            return {c.state.room, c.state.active_hazards, c.state.distances,
+                    c.state.timers, c.state.tick};
+        }
+
+      public:
+        explicit cells(chunked_room &room) : room_(room) {}
+
+        sig size() const { return room_.size_; }
+        bool passable(sig x, sig y) {
+            auto &c = at(x, y);
+            return c.state.room[0].has_flags(x - c.x, y - c.y,
+                                             tile::flag_bits::passable);
+        }
+        void show(sig x, sig y, tile::idents t) {
+            auto &c = at(x, y);
+            c.state.room[2].at(x - c.x, y - c.y) = t;
+        }
+        void blast(sig x, sig y, tile::idents residue) {
+            auto &c = at(x, y);
+            chunk_cells(c).blast(x - c.x, y - c.y, residue);
+            c.changed = true;
+            auto [x0, y0] = room_.field_origin_;
+            if (x >= x0 && y >= y0 && x < x0 + FIELD_SIZE &&
+                y < y0 + FIELD_SIZE) {
+                room_.field_terrain_.set(x - x0, y - y0, residue);
+                room_.distances_.open(room_.field_terrain_, {x0, y0}, x, y);
+            }
+        }
+        void dissipate(sig x, sig y, tile::idents kind) {
+            auto &c = at(x, y);
+            chunk_cells(c).dissipate(x - c.x, y - c.y, kind);
+        }
+    };
+
+    /**
+     * Simulates a tick of the chunks that overlap [x0,x1]x[y0,y1], with the
+     * player in room coordinates. The projectiles fly on wherever they go.
+     * `due` is scratch space.
+     */
+    void simulate(sig x0, sig y0, sig x1, sig y1, specimen &player,
+                  vector<plane_coord> &due) {
+        distances_.retarget(player.pos);
+        if (distances_.starting()) {
+            auto last = max(size_ - FIELD_SIZE, sig(0));
+            field_origin_ = {
+                clamp(sig(player.pos.x()) - FIELD_SIZE / 2, sig(0), last),
+                clamp(sig(player.pos.y()) - FIELD_SIZE / 2, sig(0), last)};
+            copy_field_terrain();
+        }
+        if (distances_.stale())
+            distances_.advance(field_terrain_, FIELD_CELLS_PER_TICK,
+                               field_origin_);
+        for_each_chunk(x0, y0, x1, y1, [&](chunk &c) {
+            c.state.tick++;
+            fire_due_hazards(c.state, player, due, moving_objects_,
+                             distances_, {c.x, c.y});
+        });
+        auto area = cells(*this);
+        move_objects(area, moving_objects_, player);
+    }
+
+    /// Calls f(chunk) for every loaded chunk that overlaps [x0,x1]x[y0,y1].
+    template <class F>
+    void for_each_chunk(sig x0, sig y0, sig x1, sig y1, F f) {
+        for (auto &[i, c] : chunks_)
+            if (c.x + CHUNK_SIZE > x0 && c.x <= x1 && c.y + CHUNK_SIZE > y0 &&
+                c.y <= y1)
+                f(c);
+    }
+
+    size_t memory_footprint() const {
+        auto r = sizeof(*this);
+        for (auto &[i, c] : chunks_)
+            r += ::memory_footprint(c.state);
+        for (auto &[i, diff] : changes_)
+            r += diff.capacity() * sizeof(terrain_change);
+        r += moving_objects_.capacity_bytes() + distances_.memory_footprint();
+        r += size_t(field_terrain_.stride() * field_terrain_.size()) +
+             size_t(FIELD_SIZE * FIELD_SIZE) / 8;
+        return r;
+    }
+};
@@ -1,21 +1,34 @@
+/**
+ * Adjacency-list graph, also used as the builder of a csr_graph.
+ * Every adjacency carries a weight (1 unless given), which only csr_graph
+ * and dijkstra take into account.
+ */
 class graph {
     using s = vector<int>::size_type;
     vector<vector<int>> adj_;
+    vector<vector<int>> weights_;
 
   public:
-    graph(int n) : adj_(s(n)) {}
-    graph(vector<vector<int>> adj) : adj_(move(adj)) {}
+    graph(int n) : adj_(s(n)), weights_(s(n)) {}
+    graph(vector<vector<int>> adj) : adj_(move(adj)) {
+        for (auto &a : adj_)
+            weights_.push_back(vector<int>(a.size(), 1));
+    }
 
-    void add_vertex() { adj_.push_back({}); }
-    void add_adjacency(int u, int v, bool both_ways = true) {
+    void add_vertex() { adj_.push_back({}), weights_.push_back({}); }
+    void add_adjacency(int u, int v, bool both_ways = true, int weight = 1) {
         adj_.at(s(u)).push_back(v);
-        if (both_ways)
+        weights_.at(s(u)).push_back(weight);
+        if (both_ways) {
             adj_.at(s(v)).push_back(u);
+            weights_.at(s(v)).push_back(weight);
+        }
     }
     /**
      * Adds vertices of degree 1 between u and u.head(k).
      * This is a cheap way to accomplish weighted edges in combination with
-     * DFS/BFS.
+     * DFS/BFS. It costs a vertex per unit of weight; a csr_graph with native
+     * weights and dijkstra does not.
      * @param w added weight for the adjacency <u,k> (w=0: no added weight)
      */
     void add_weight(int u, int k, int w);
@@ -25,6 +38,7 @@ class graph {
     vector<int> const &adj(int u) const { return adj_.at(s(u)); }
     int head(int u, int k) const { return adj(u).at(s(k)); }
     int &head(int u, int k) { return adj_.at(s(u)).at(s(k)); }
+    int weight(int u, int k) const { return weights_.at(s(u)).at(s(k)); }
 };
 
 void graph::add_weight(int u, int k, int w) {
@@ -33,6 +47,7 @@ void graph::add_weight(int u, int k, int w) {
     int v = head(u, k);
     for (int a = 0; a < w; a++) {
         adj_.push_back({-1});
+        weights_.push_back({1});
         head(u, k) = order() - 1;
         u = order() - 1;
         k = 0;
@@ -40,6 +55,52 @@ void graph::add_weight(int u, int k, int w) {
     head(u, k) = v;
 }
 
+/**
+ * Immutable graph in compressed sparse row form: the heads and weights of
+ * all vertices lie in two contiguous arrays, indexed through per-vertex
+ * offsets. Built from a graph, whose adjacency order it keeps.
+ */
+class csr_graph {
+    using s = vector<int>::size_type;
+    vector<int> offsets_; // order() + 1 entries
+    vector<int> heads_, weights_;
+
+  public:
+    /// Contiguous run of heads or weights.
+    struct range {
+        int const *begin_, *end_;
+        int const *begin() const { return begin_; }
+        int const *end() const { return end_; }
+        int size() const { return int(end_ - begin_); }
+    };
+
+    explicit csr_graph(graph const &g) : offsets_(s(g.order()) + 1) {
+        for (int u = 0; u < g.order(); u++) {
+            offsets_[s(u) + 1] = offsets_[s(u)] + g.deg(u);
+            for (int k = 0; k < g.deg(u); k++) {
+                heads_.push_back(g.head(u, k));
+                weights_.push_back(g.weight(u, k));
+            }
+        }
+    }
+
+    int order() const { return int(offsets_.size()) - 1; }
+    int size() const { return int(heads_.size()); }
+    int deg(int u) const { return offsets_[s(u) + 1] - offsets_[s(u)]; }
+    range adj(int u) const {
+        return {heads_.data() + offsets_[s(u)],
+                heads_.data() + offsets_[s(u) + 1]};
+    }
+    range weights(int u) const {
+        return {weights_.data() + offsets_[s(u)],
+                weights_.data() + offsets_[s(u) + 1]};
+    }
+    int head(int u, int k) const { return heads_[s(offsets_[s(u)] + k)]; }
+    int weight(int u, int k) const {
+        return weights_[s(offsets_[s(u)] + k)];
+    }
+};
+
 ostream &operator<<(ostream &o, graph const &g) {
     for (int u = 0; u < g.order(); u++) {
         o << u << ": ";
@@ -50,19 +111,23 @@ ostream &operator<<(ostream &o, graph const &g) {
     return o;
 }
 
-class bfs {
+/**
+ * The traversals work on any graph type G with order(), deg(u), head(u,k)
+ * and an iterable adj(u), such as graph and csr_graph.
+ */
+template <class G = graph> class bfs {
     using s = vector<int>::size_type;
-    graph const &g_;
+    G const &g_;
     vector<int> parent_;
     queue<int> q_;
 
   public:
-    bfs(graph const &g) : g_(g), parent_(s(g_.order()), -1) {}
+    bfs(G const &g) : g_(g), parent_(s(g_.order()), -1) {}
     /// Returns the path in reverse order: {to,parent(to),...,from}
     optional<vector<int>> path(int from, int to);
 };
 
-optional<vector<int>> bfs::path(int from, int to) {
+template <class G> optional<vector<int>> bfs<G>::path(int from, int to) {
     q_.push(from);
     vector<int> r;
     while (!q_.empty()) {
@@ -85,19 +150,19 @@ optional<vector<int>> bfs::path(int from, int to) {
     return {};
 }
 
-class dfs {
+template <class G = graph> class dfs {
     using s = vector<char>::size_type;
     struct dfs_elem {
         int u, k;
     };
     enum color : char { WHITE = 0, GRAY, BLACK };
-    graph const &g_;
+    G const &g_;
     vector<char> c_;
     vector<dfs_elem> s_;
 
   public:
     enum class time_types { discover, finish };
-    dfs(graph const &g) : g_(g), c_(s(g_.order())) {}
+    dfs(G const &g) : g_(g), c_(s(g_.order())) {}
     optional<int> time(int from, int to,
                        time_types type = time_types::discover) {
         int t = 0;
@@ -123,3 +188,50 @@ class dfs {
         return {};
     }
 };
+
+/**
+ * Shortest paths by edge weight (non-negative) with a binary heap.
+ * G additionally needs weight(u,k), as csr_graph has.
+ */
+template <class G = csr_graph> class dijkstra {
+    using s = vector<int>::size_type;
+    using entry = pair<int, int>; // distance, vertex
+    G const &g_;
+    vector<int> dist_, parent_;
+    priority_queue<entry, vector<entry>, greater<entry>> q_;
+
+  public:
+    dijkstra(G const &g)
+        : g_(g), dist_(s(g_.order()), -1), parent_(s(g_.order()), -1) {}
+
+    /// Returns the path in reverse order: {to,parent(to),...,from}
+    optional<vector<int>> path(int from, int to) {
+        dist_[s(from)] = 0;
+        q_.push({0, from});
+        while (!q_.empty()) {
+            auto [d, u] = q_.top();
+            q_.pop();
+            if (d > dist_[s(u)])
+                continue;
+            if (u == to) {
+                vector<int> r;
+                for (auto a = to; a != from; a = parent_[s(a)])
+                    r.push_back(a);
+                r.push_back(from);
+                return r;
+            }
+            for (int k = 0; k < g_.deg(u); k++) {
+                auto v = g_.head(u, k), dv = d + g_.weight(u, k);
+                if (dist_[s(v)] >= 0 && dist_[s(v)] <= dv)
+                    continue;
+                dist_[s(v)] = dv;
+                parent_[s(v)] = u;
+                q_.push({dv, v});
+            }
+        }
+        return {};
+    }
+    /// Distance of v from the last path()'s origin: exact for the vertices
+    /// of the returned path, an upper bound for others, -1 if not reached.
+    int distance(int v) const { return dist_[s(v)]; }
+};
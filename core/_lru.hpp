@@ -0,0 +1,65 @@
+/**
+ * Least-recently-used cache with a size budget.
+ * The cost of an entry is computed once on insertion; the oldest entries are
+ * evicted until the total cost fits the budget again (the newest entry is
+ * always kept).
+ */
+template <class K, class V> class lru_cache {
+    struct entry {
+        K key;
+        V val;
+        size_t cost;
+    };
+    size_t budget_, used_ = 0;
+    function<size_t(V const &)> cost_;
+    list<entry> entries_; // most recently used first
+    unordered_map<K, typename list<entry>::iterator> index_;
+    nat hits_ = 0, misses_ = 0;
+
+    void erase(typename list<entry>::iterator it) {
+        used_ -= it->cost;
+        index_.erase(it->key);
+        entries_.erase(it);
+    }
+
+  public:
+    lru_cache(size_t budget, function<size_t(V const &)> cost)
+        : budget_(budget), cost_(move(cost)) {}
+
+    bool contains(K const &key) const { return index_.count(key); }
+
+    /// Looks at an entry without counting it as a use.
+    V const *peek(K const &key) const {
+        auto it = index_.find(key);
+        return it == index_.end() ? nullptr : &it->second->val;
+    }
+
+    /// Removes the entry and returns it, counting a hit or a miss.
+    optional<V> take(K const &key) {
+        auto it = index_.find(key);
+        if (it == index_.end()) {
+            misses_++;
+            return {};
+        }
+        hits_++;
+        auto r = move(it->second->val);
+        erase(it->second);
+        return r;
+    }
+
+    void put(K key, V val) {
+        if (auto it = index_.find(key); it != index_.end())
+            erase(it->second);
+        auto cost = cost_(val);
+        entries_.push_front({key, move(val), cost});
+        index_[move(key)] = entries_.begin();
+        used_ += cost;
+        while (used_ > budget_ && entries_.size() > 1)
+            erase(prev(entries_.end()));
+    }
+
+    size_t size() const { return entries_.size(); }
+    size_t used() const { return used_; }
+    nat hits() const { return hits_; }
+    nat misses() const { return misses_; }
+};
@@ -2,16 +2,21 @@
 #include <array>
 #include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <fstream>
 #include <functional>
 #include <iostream>
+#include <list>
 #include <map>
+#include <mutex>
 #include <optional>
 #include <queue>
 #include <random>
 #include <set>
 #include <string>
 #include <thread>
+#include <unordered_map>
 #include <vector>
 
 using nat = unsigned long long; // C++ guarantees >=64 bits for ULL
@@ -24,6 +29,8 @@ size_t operator""_s(unsigned long long p) { return static_cast<size_t>(p); }
 
 #include <_graph.hpp>
 #include <_iota.hpp>
+#include <_lru.hpp>
+#include <_profile.hpp>
 #include <_random.hpp>
 #include <_range.hpp>
 #include <_scope.hpp>
@@ -0,0 +1,120 @@
+/**
+ * Per-stage timer for a frame loop.
+ * Every stage keeps its most recent WINDOW samples in a ring buffer, from
+ * which percentiles are computed on demand, and a log2 histogram of all its
+ * samples. While the profiler is disabled, a stage timer only tests a flag.
+ */
+class frame_profiler {
+  public:
+    static constexpr size_t WINDOW = 256;
+    static constexpr size_t BUCKETS = 40; // bucket i: [2^i, 2^(i+1)) ns
+    using clock = chrono::steady_clock;
+
+    struct percentiles {
+        double p50, p95, p99; // microseconds
+        size_t samples;
+    };
+
+    /// Measures the lifetime of the object as one sample of a stage.
+    class stage_timer {
+        frame_profiler *p_;
+        size_t stage_;
+        clock::time_point start_;
+
+      public:
+        stage_timer(frame_profiler *p, size_t stage)
+            : p_(p), stage_(stage),
+              start_(p ? clock::now() : clock::time_point()) {}
+        ~stage_timer() {
+            if (p_)
+                p_->record(stage_, clock::now() - start_);
+        }
+        stage_timer(stage_timer const &) = delete;
+        stage_timer &operator=(stage_timer const &) = delete;
+    };
+
+  private:
+    struct stage {
+        string name;
+        array<uint64_t, WINDOW> ring{};
+        size_t next = 0, samples = 0;
+        array<uint64_t, BUCKETS> histogram{};
+    };
+    vector<stage> stages_;
+    bool enabled_ = false;
+
+  public:
+    explicit frame_profiler(vector<string> const &stage_names) {
+        for (auto &name : stage_names)
+            stages_.push_back({name});
+    }
+
+    bool enabled() const { return enabled_; }
+    void enable(bool on) { enabled_ = on; }
+
+    stage_timer time(size_t stage) {
+        return {enabled_ ? this : nullptr, stage};
+    }
+    void record(size_t stage, clock::duration d) {
+        auto &s = stages_[stage];
+        auto ns = uint64_t(
+            max(chrono::duration_cast<chrono::nanoseconds>(d).count(),
+                chrono::nanoseconds::rep(0)));
+        s.ring[s.next] = ns;
+        s.next = (s.next + 1) % WINDOW;
+        s.samples++;
+        auto bucket = size_t(0);
+        while (bucket + 1 < BUCKETS && ns >> (bucket + 1))
+            bucket++;
+        s.histogram[bucket]++;
+    }
+
+    size_t stage_count() const { return stages_.size(); }
+    string const &name(size_t stage) const { return stages_[stage].name; }
+
+    /// Percentiles of the stage's most recent samples.
+    percentiles recent(size_t stage) const {
+        auto &s = stages_[stage];
+        auto n = min(s.samples, WINDOW);
+        if (n == 0)
+            return {0, 0, 0, 0};
+        auto sorted = s.ring;
+        sort(begin(sorted), begin(sorted) + long(n));
+        auto at = [&](double q) {
+            return double(sorted[min(n - 1, size_t(q * double(n)))]) / 1000;
+        };
+        return {at(.5), at(.95), at(.99), n};
+    }
+
+    /// One line per stage and histogram bucket: stage,lower_ns,upper_ns,count
+    void write_csv(ostream &o) const {
+        o << "stage,lower_ns,upper_ns,count\n";
+        for (auto &s : stages_)
+            for (auto i : nums(0_s, BUCKETS))
+                if (s.histogram[i])
+                    o << s.name << "," << (i ? uint64_t(1) << i : 0) << ","
+                      << (uint64_t(1) << (i + 1)) << "," << s.histogram[i]
+                      << "\n";
+    }
+    void write_json(ostream &o) const {
+        o << "{\"stages\": [\n";
+        for (auto i : nums(0_s, stages_.size())) {
+            auto &s = stages_[i];
+            auto p = recent(i);
+            o << "  {\"name\": \"" << s.name << "\", \"samples\": " << s.samples
+              << ", \"recent_us\": {\"p50\": " << p.p50
+              << ", \"p95\": " << p.p95 << ", \"p99\": " << p.p99
+              << "}, \"histogram\": [";
+            auto first = true;
+            for (auto b : nums(0_s, BUCKETS))
+                if (s.histogram[b]) {
+                    o << (first ? "" : ", ") << "{\"lower_ns\": "
+                      << (b ? uint64_t(1) << b : 0)
+                      << ", \"count\": " << s.histogram[b] << "}";
+                    first = false;
+                }
+            o << (i + 1 < stages_.size() ? "]},\n" : "]}\n");
+        }
+        o << "]}\n";
+    }
+};
@@ -1,20 +1,132 @@
+/**
+ * Counter-based random numbers: number i of a stream is the SplitMix64 hash
+ * of the stream's key and i. The whole state is two words, any number of a
+ * stream can be read without producing the ones before it, and independent
+ * substreams are split off without touching the parent. Results only depend
+ * on the seed and on which numbers are read, not on the standard library or
+ * on the thread that reads them.
+ */
 class random_gen {
-    mt19937_64 rand_;
+    static constexpr uint64_t GOLDEN = 0x9e3779b97f4a7c15;
+    uint64_t key_, counter_ = 0;
+
+    static constexpr uint64_t mix(uint64_t z) {
+        z = (z ^ z >> 30) * 0xbf58476d1ce4e5b9;
+        z = (z ^ z >> 27) * 0x94d049bb133111eb;
+        return z ^ z >> 31;
+    }
 
   public:
-    random_gen(mt19937_64::result_type seed) : rand_(seed) {}
+    using result_type = uint64_t;
+
+    random_gen(uint64_t seed) : key_(mix(seed)) {}
+
+    /// Number i of the stream, regardless of how far it has advanced.
+    uint64_t at(uint64_t i) const { return mix(key_ + (i + 1) * GOLDEN); }
+    /// The stream for `key` (a room, a chunk, a worker...), which is the
+    /// same whenever it is split off and independent of this one.
+    random_gen split(uint64_t key) const {
+        auto r = *this;
+        r.key_ = mix(key_ ^ mix(key + GOLDEN)), r.counter_ = 0;
+        return r;
+    }
+
+    uint64_t operator()() { return at(counter_++); }
+    /// Writes the next n numbers of the stream to `out`.
+    void fill(uint64_t *out, size_t n) {
+        for (size_t i = 0; i < n; i++)
+            out[i] = at(counter_ + i);
+        counter_ += n;
+    }
+    void discard(uint64_t n) { counter_ += n; }
+
+    /// Uniform in [0, n) without bias (Lemire's multiply and reject).
+    uint64_t below(uint64_t n) {
+        auto m = __uint128_t((*this)()) * n;
+        if (uint64_t(m) < n)
+            for (auto threshold = (0 - n) % n; uint64_t(m) < threshold;)
+                m = __uint128_t((*this)()) * n;
+        return uint64_t(m >> 64);
+    }
+    /// Uniform in [from, to].
     template <class I>
-    auto get(I from = numeric_limits<I>::min(),
-             I to = numeric_limits<I>::max()) {
-        auto dist = uniform_int_distribution<I>(from, to);
-        return dist(rand_);
-    }
-    auto get_real(double from = numeric_limits<double>::min(),
-                  double to = numeric_limits<double>::max()) {
-        auto dist = uniform_real_distribution<double>(from, to);
-        return dist(rand_);
-    }
-    auto operator()() { return rand_(); }
-    static constexpr auto min() { return decltype(rand_)::min(); }
-    static constexpr auto max() { return decltype(rand_)::max(); }
+    I get(I from = numeric_limits<I>::min(),
+          I to = numeric_limits<I>::max()) {
+        auto range = uint64_t(to) - uint64_t(from);
+        if (range == numeric_limits<uint64_t>::max())
+            return I((*this)());
+        return I(uint64_t(from) + below(range + 1));
+    }
+    /// Uniform in [from, to).
+    double get_real(double from = numeric_limits<double>::min(),
+                    double to = numeric_limits<double>::max()) {
+        return from + (to - from) * double((*this)() >> 11) * 0x1p-53;
+    }
+
+    static constexpr uint64_t min() { return 0; }
+    static constexpr uint64_t max() { return numeric_limits<uint64_t>::max(); }
+};
+
+/**
+ * Walker alias table for drawing from N weighted outcomes. Every column
+ * holds an outcome and an alias; a draw picks a column and one of the two
+ * from the two halves of a single random number, without branches. The
+ * table is built by a constexpr constructor, so fixed weight sets cost
+ * nothing at run time.
+ */
+template <class T, size_t N> class alias_table {
+    static constexpr uint64_t ONE = uint64_t(1) << 32;
+    array<uint64_t, N> keep_{}; // chance of the column's own outcome, in ONEs
+    array<array<T, 2>, N> outcomes_{}; // own outcome and alias
+
+  public:
+    /// Vose's method: columns below the mean weight are topped up from
+    /// columns above it.
+    constexpr alias_table(array<pair<T, double>, N> const &weights) {
+        auto total = 0.0;
+        for (size_t i = 0; i < N; i++)
+            total += weights[i].second;
+        array<double, N> share{};
+        array<size_t, N> small{}, large{};
+        size_t smalls = 0, larges = 0;
+        for (size_t i = 0; i < N; i++) {
+            share[i] = weights[i].second * double(N) / total;
+            outcomes_[i][0] = outcomes_[i][1] = weights[i].first;
+            if (share[i] < 1)
+                small[smalls++] = i;
+            else
+                large[larges++] = i;
+        }
+        while (smalls && larges) {
+            auto s = small[--smalls], l = large[--larges];
+            keep_[s] = uint64_t(share[s] * double(ONE));
+            outcomes_[s][1] = weights[l].first;
+            share[l] -= 1 - share[s];
+            if (share[l] < 1)
+                small[smalls++] = l;
+            else
+                large[larges++] = l;
+        }
+        // what is left has a share of 1, up to rounding
+        while (larges)
+            keep_[large[--larges]] = ONE;
+        while (smalls)
+            keep_[small[--smalls]] = ONE;
+    }
+
+    /// The outcome for a uniformly random number.
+    constexpr T operator()(uint64_t r) const {
+        auto column = size_t((r >> 32) * N >> 32);
+        return outcomes_[column][(r & (ONE - 1)) >= keep_[column]];
+    }
+    /// Draws n outcomes into `out`, one number of `rand` each.
+    void fill(random_gen &rand, T *out, size_t n) const {
+        array<uint64_t, 256> numbers;
+        for (size_t i = 0; i < n; i += numbers.size()) {
+            auto m = min(numbers.size(), n - i);
+            rand.fill(numbers.data(), m);
+            for (size_t j = 0; j < m; j++)
+                out[i + j] = (*this)(numbers[j]);
+        }
+    }
 };
@@ -0,0 +1,18 @@
+#pragma once
+#include <atomic>
+#include <cstdlib>
+#include <exception>
+/**
+ * Counts heap allocations by replacing the global operator new. Only for
+ * tools that report allocations; include it in one translation unit.
+ */
+std::atomic<unsigned long long> allocation_count = 0;
+
+void *operator new(std::size_t n) {
+    allocation_count++;
+    if (auto *p = std::malloc(n))
+        return p;
+    std::terminate();
+}
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
@@ -10,6 +10,8 @@
 #include <SDL2/SDL_video.h>
 #include <array>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 class Init {
   public:
@@ -38,6 +40,12 @@ class Window {
     operator SDL_Surface *() const { return surface_; }
 
     void updateWindow() const { SDL_UpdateWindowSurface(window_); }
+    /// Copies only the given areas of the window surface to the screen.
+    void updateWindow(std::vector<SDL_Rect> const &areas) const {
+        if (!areas.empty())
+            SDL_UpdateWindowSurfaceRects(window_, areas.data(),
+                                         int(areas.size()));
+    }
 
     void clear(SDL_Color color, SDL_Rect const *area = NULL) const {
         auto format = surface_->format;
@@ -129,9 +137,14 @@ class Image {
 /**
  * Don't forget to init the SDL2_ttf library:
  *      assert_true((TTF_Init() == 0, "TTF init failed");
+ *
+ * Single glyphs are rasterized once per (symbol, fg, bg) and kept as
+ * cell-sized surfaces in the format of the first target they were drawn to.
+ * Afterwards, drawing a glyph is a single blit.
  */
 class Font {
     TTF_Font *font_;
+    mutable std::unordered_map<Uint64, SDL_Surface *> glyphs_;
 
     std::pair<int, int> getDimensions(std::string const &text) const {
         int w, h;
@@ -139,20 +152,69 @@ class Font {
         return {w, h};
     }
 
+    static Uint64 glyphKey(char symbol,
+                           std::pair<SDL_Color, SDL_Color> const &colorPair) {
+        auto rgb = [](SDL_Color c) {
+            return Uint64(c.r) << 16 | Uint64(c.g) << 8 | Uint64(c.b);
+        };
+        return Uint64(Uint8(symbol)) << 48 | rgb(colorPair.first) << 24 |
+               rgb(colorPair.second);
+    }
+
   public:
     Font(std::string name, int height)
         : font_(TTF_OpenFont(name.c_str(), height)) {
         assert_true(font_ != NULL, "OpenFont error");
     }
-    ~Font() { TTF_CloseFont(font_); }
+    ~Font() {
+        for (auto &[key, surface] : glyphs_)
+            SDL_FreeSurface(surface);
+        TTF_CloseFont(font_);
+    }
     DEF_COPY(Font, delete)
     DEF_MOVE(Font, delete)
 
     auto height() const { return TTF_FontHeight(font_); }
 
-    auto renderToSurface(std::string text,
+    /// Returns the cached surface for a glyph, rasterizing it on first use.
+    SDL_Surface *cacheGlyph(char symbol,
+                            std::pair<SDL_Color, SDL_Color> colorPair,
+                            SDL_PixelFormat const *format) const {
+        auto key = glyphKey(symbol, colorPair);
+        if (auto it = glyphs_.find(key); it != glyphs_.end())
+            return it->second;
+        auto text = std::string({symbol});
+        auto [w, h] = getDimensions(text);
+        auto &[fgColor, bgColor] = colorPair;
+        auto *cell = SDL_CreateRGBSurfaceWithFormat(
+            0, w, h, format->BitsPerPixel, format->format);
+        assert_true(cell != NULL, "glyph surface creation failed");
+        SDL_FillRect(cell, NULL,
+                     SDL_MapRGB(cell->format, bgColor.r, bgColor.g, bgColor.b));
+        auto *fontSurface =
+            TTF_RenderText_Blended(font_, text.c_str(), fgColor);
+        SDL_BlitSurface(fontSurface, NULL, cell, NULL);
+        SDL_FreeSurface(fontSurface);
+        glyphs_[key] = cell;
+        return cell;
+    }
+
+    /// Returns the pixel area that was drawn to.
+    SDL_Rect renderGlyph(char symbol,
                          std::pair<SDL_Color, SDL_Color> colorPair,
                          SDL_Surface *target, int x, int y) const {
+        auto *cell = cacheGlyph(symbol, colorPair, target->format);
+        SDL_Rect targetArea{x * cell->w, y * cell->h, cell->w, cell->h};
+        SDL_BlitSurface(cell, NULL, target, &targetArea);
+        return targetArea;
+    }
+
+    /// Returns the pixel area that was drawn to.
+    SDL_Rect renderToSurface(std::string text,
+                             std::pair<SDL_Color, SDL_Color> colorPair,
+                             SDL_Surface *target, int x, int y) const {
+        if (text.size() == 1)
+            return renderGlyph(text[0], colorPair, target, x, y);
         auto [w, h] = getDimensions(text);
         auto &[fgColor, bgColor] = colorPair;
         auto *fontSurface =
@@ -163,5 +225,6 @@ class Font {
             SDL_MapRGB(target->format, bgColor.r, bgColor.g, bgColor.b));
         SDL_BlitSurface(fontSurface, NULL, target, &targetArea);
         SDL_FreeSurface(fontSurface);
+        return targetArea;
     }
 };
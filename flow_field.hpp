@@ -0,0 +1,166 @@
+#pragma once
+#include <_main.hpp>
+#include "cell_graph.hpp"
+#include "coord.hpp"
+#include "grid.hpp"
+
+/**
+ * Distances from a target cell (usually the player) over passable tiles,
+ * 8-connected like the flight of a projectile. Anything on the room can
+ * read its next step towards the target in constant time.
+ *
+ * The field covers size() x size() cells of the room from an origin, which
+ * is (0,0) on an ordinary room and follows the target on a chunked one.
+ * Targets and readers use room coordinates; cells outside the field are
+ * unreachable.
+ *
+ * The field is computed by a breadth-first sweep that advance() carries on
+ * for a bounded number of cells, so that its cost is spread over several
+ * ticks. Readers see the last completed sweep.
+ *
+ * Blasted tiles are repaired in place (see open()). A move of the target
+ * changes nearly every distance, so it is not repaired but swept anew: a
+ * sweep takes up to cells / budget ticks, and a move during a sweep waits
+ * for it to finish. The field thus lags the target by at most twice that,
+ * which is 8 ticks (a third of a second) for a 64x64 room at
+ * FLOW_FIELD_CELLS_PER_TICK.
+ */
+class flow_field {
+    sig size_;
+    vector<int32_t> front_, back_; // completed and ongoing sweep
+    pair<sig, sig> front_origin_{}, back_origin_{};
+    vector<int> frontier_;
+    size_t head_ = 0;
+    vector<int> repaired_; // cells that got closer, to be passed on
+    optional<plane_coord> target_;
+    bool stale_ = false, sweeping_ = false, ready_ = false;
+
+    size_t cell(sig x, sig y) const { return size_t(y * size_ + x); }
+    bool inside(sig x, sig y) const {
+        return x >= 0 && y >= 0 && x < size_ && y < size_;
+    }
+
+  public:
+    static constexpr int32_t UNREACHABLE = -1;
+
+    explicit flow_field(sig size)
+        : size_(size), front_(size_t(size * size), UNREACHABLE),
+          back_(front_.size()) {}
+
+    /// Whether a sweep has completed, i.e. whether the field can be read.
+    bool ready() const { return ready_; }
+    /// Whether the field lags behind the target or the terrain.
+    bool stale() const { return stale_ || sweeping_; }
+    /// Whether the next advance() starts a new sweep.
+    bool starting() const { return stale_ && !sweeping_; }
+
+    void retarget(plane_coord const &target) {
+        if (target_ != target)
+            target_ = target, stale_ = true;
+    }
+    /// Has to be called when tiles became passable or impassable, unless
+    /// open() covers it.
+    void invalidate() { stale_ = target_.has_value(); }
+
+    /**
+     * Has to be called when the tile at (x,y) became passable, with the
+     * terrain that advance() reads and its origin. The completed field is
+     * repaired by passing the shorter ways through (x,y) on, which only
+     * visits the cells that get closer to the target. A sweep under way
+     * cannot take the change in and is redone.
+     */
+    void open(grid const &terrain, pair<sig, sig> origin, sig x, sig y) {
+        if (sweeping_)
+            stale_ = true;
+        x -= origin.first, y -= origin.second;
+        if (!ready_ || origin != front_origin_ || !inside(x, y))
+            return;
+        auto cells = cell_graph(terrain, passable_tiles(terrain), true);
+        auto u = size_t(cell(x, y));
+        for (auto v : cells.adj(int(u)))
+            if (auto d = front_[size_t(v)];
+                d != UNREACHABLE &&
+                (front_[u] == UNREACHABLE || d + 1 < front_[u]))
+                front_[u] = d + 1;
+        if (front_[u] == UNREACHABLE)
+            return;
+        repaired_.assign(1, int(u));
+        for (size_t head = 0; head < repaired_.size(); head++) {
+            auto w = repaired_[head];
+            for (auto v : cells.adj(w))
+                if (front_[size_t(v)] == UNREACHABLE ||
+                    front_[size_t(w)] + 1 < front_[size_t(v)]) {
+                    front_[size_t(v)] = front_[size_t(w)] + 1;
+                    repaired_.push_back(v);
+                }
+        }
+    }
+
+    /**
+     * Carries the sweep on for at most `budget` cells. `terrain` holds the
+     * cells of the field, its (0,0) being room cell `origin`; a new sweep
+     * takes on that origin, which has to put the target inside the field.
+     */
+    void advance(grid const &terrain, sig budget,
+                 pair<sig, sig> origin = {0, 0}) {
+        if (!sweeping_) {
+            if (!stale_)
+                return;
+            back_origin_ = origin;
+            auto start = int(cell(sig(target_->x()) - origin.first,
+                                  sig(target_->y()) - origin.second));
+            fill(begin(back_), end(back_), UNREACHABLE);
+            back_[size_t(start)] = 0;
+            frontier_.assign(1, start);
+            head_ = 0;
+            stale_ = false, sweeping_ = true;
+        }
+        auto cells = cell_graph(terrain, passable_tiles(terrain), true);
+        for (; budget > 0 && head_ < frontier_.size(); budget--) {
+            auto u = frontier_[head_++];
+            for (auto v : cells.adj(u))
+                if (back_[size_t(v)] == UNREACHABLE) {
+                    back_[size_t(v)] = back_[size_t(u)] + 1;
+                    frontier_.push_back(v);
+                }
+        }
+        if (head_ == frontier_.size()) {
+            swap(front_, back_);
+            front_origin_ = back_origin_;
+            sweeping_ = false, ready_ = true;
+        }
+    }
+
+    int32_t distance(sig x, sig y) const {
+        x -= front_origin_.first, y -= front_origin_.second;
+        return ready_ && inside(x, y) ? front_[cell(x, y)] : UNREACHABLE;
+    }
+
+    /**
+     * The direction of the neighbour of (x,y) that is closest to the target,
+     * or nothing if none of them is reachable. (x,y) itself need not be
+     * passable, so a trap in a wall finds the way out of it.
+     */
+    optional<pair<sig, sig>> next_step(sig x, sig y) const {
+        auto r = optional<pair<sig, sig>>();
+        if (!ready_)
+            return r;
+        x -= front_origin_.first, y -= front_origin_.second;
+        auto best = inside(x, y) ? front_[cell(x, y)] : UNREACHABLE;
+        for (sig dy = -1; dy <= 1; dy++)
+            for (sig dx = -1; dx <= 1; dx++) {
+                auto vx = x + dx, vy = y + dy;
+                if (!inside(vx, vy))
+                    continue;
+                auto d = front_[cell(vx, vy)];
+                if (d != UNREACHABLE && (best == UNREACHABLE || d < best))
+                    best = d, r = {dx, dy};
+            }
+        return r;
+    }
+
+    size_t memory_footprint() const {
+        return (front_.capacity() + back_.capacity()) * sizeof(int32_t) +
+               (frontier_.capacity() + repaired_.capacity()) * sizeof(int);
+    }
+};
@@ -1,74 +1,48 @@
 #include <_main.hpp>
+#include <cstdlib>
+#include <cstring>
 #include <sdl_wrap.hpp>
 
 #include "builder.hpp"
+#include "chunked_room.hpp"
 #include "color.hpp"
 #include "coord.hpp"
 #include "grid.hpp"
+#include "input_log.hpp"
+#include "render.hpp"
+#include "room_pool.hpp"
+#include "simulation.hpp"
 #include "tile.hpp"
+#include "world_file.hpp"
 
 sig const FRAMES_PER_SECOND = 24;
+/// Upper bound for the memory held by rooms the player has left.
+size_t const ROOM_CACHE_BUDGET = 64 << 20;
+
+/// Stages of display_room() timed by the frame profiler.
+struct frame_stages {
+    static size_t const hazards = 0, movement = 1, cells = 2, text = 3,
+                        present = 4, wait = 5, flow = 6;
+    frame_stages() = delete;
+};
+vector<string> const FRAME_STAGE_NAMES = {
+    "hazards", "movement", "cells", "text", "present", "wait", "flow"};
 
-bool tile_satisfies_flags(grid const &grid,
-                          map<tile::idents, tile> const &tiles,
-                          plane_coord const &coord, sig flags) {
-    auto tile_flags = static_cast<sig>(tiles.at(grid[coord]).flags);
-    return tile_flags & flags;
-}
-
-optional<plane_coord> find_adjoining_tile(grid const &grid,
-                                          map<tile::idents, tile> const &tiles,
-                                          plane_coord const &coord,
-                                          tile::idents tile) {
-    sig x = coord.x(), y = coord.y();
-    for (auto &c : vector<pair<sig, sig>>({{x - 1, y - 1},
-                                           {x, y - 1},
-                                           {x + 1, y - 1},
-                                           {x - 1, y},
-                                           {x + 1, y},
-                                           {x - 1, y + 1},
-                                           {x, y + 1},
-                                           {x + 1, y + 1}}))
-        if (static_cast<tile::idents>(grid[{c.first, c.second}]) == tile)
-            return {{c.first, c.second, grid.size() - 1, 0}};
-    return {};
-}
-
-string get_description(grid const &grid, map<tile::idents, tile> const &tiles,
+string get_description(grid const &grid, tile_table const &tiles,
                        map<plane_coord, sig> const &out_doors,
                        plane_coord const &coord) {
     auto ident = static_cast<tile::idents>(grid[coord]);
-    auto desc = tiles.at(ident).description;
-    if (tile_satisfies_flags(grid, tiles, coord, tile::flag_bits::interactable))
+    auto desc = tiles.description(ident);
+    if (tile_satisfies_flags(grid, coord, tile::flag_bits::interactable))
         return "(Press e to interact with " + desc + ")";
     if (ident == tile::idents::doorway)
         return "\"Room " + to_string(out_doors.at(coord)) + "\"";
-    if (auto o_door =
-            find_adjoining_tile(grid, tiles, coord, tile::idents::doorway);
+    if (auto o_door = find_adjoining_tile(grid, coord, tile::idents::doorway);
         ident == tile::idents::doorway_sigil && o_door)
         return get_description(grid, tiles, out_doors, *o_door);
     return desc;
 }
 
-optional<char> get_tile_symbol(grid const &grid,
-                               map<tile::idents, tile> const &tiles,
-                               map<plane_coord, sig> const &doors,
-                               plane_coord const &coord) {
-    if (!tile_satisfies_flags(grid, tiles, coord,
-                              tile::flag_bits::shape_changing))
-        return tiles.at(grid[coord]).symbol;
-    switch (grid[coord]) {
-    case tile::idents::doorway_sigil: {
-        auto door_coord =
-            *find_adjoining_tile(grid, tiles, coord, tile::idents::doorway);
-        auto door_num = distance(begin(doors), doors.find(door_coord));
-        return 'A' + door_num;
-    }
-    default:
-        return {};
-    };
-}
-
 struct item {
     enum class idents {
         placeholder,
@@ -81,7 +55,8 @@ map<item::idents, item> ALL_ITEMS = {{item::idents::placeholder, {"***", 10}}};
 
 struct interaction_effect {
     struct effect_bits {
-        static sig const none = 0b0, message = 0b1, acquisition = 0b10;
+        static sig const none = 0b0, message = 0b1, acquisition = 0b10,
+                         transport = 0b100;
         effect_bits() = delete;
     };
     sig flags;
@@ -90,7 +65,6 @@ struct interaction_effect {
 };
 
 interaction_effect interact_with(random_gen &rand, grid const &grid,
-                                 map<tile::idents, tile> const &tiles,
                                  plane_coord coord) {
     switch (grid[coord]) {
     case tile::idents::chest: {
@@ -107,365 +81,574 @@ interaction_effect interact_with(random_gen &rand, grid const &grid,
                 .acquired_item = acquired};
     }
     case tile::idents::sliding_door:
-        return {.flags = interaction_effect::effect_bits::message,
-                .message = "(The door is sealed.)"};
+        return {.flags = interaction_effect::effect_bits::message |
+                         interaction_effect::effect_bits::transport,
+                .message = "(The door slides open.)"};
     default:
         return {.flags = interaction_effect::effect_bits::none};
     }
 }
 
-void print_grid(layers const &layers, map<tile::idents, tile> const &tiles,
-                map<plane_coord, sig> const &doors, Window const &win,
-                SDL_Rect const &rect, Font const &font) {
-    for (auto &grid : layers)
-        for (auto &c : grid) {
-            if (grid[c] == tile::idents::nil)
-                continue;
-            if (tiles.find(grid[c]) == tiles.end()) {
-                font.renderToSurface("?", color_idents::WHITE_ON_BLACK, win,
-                                     rect.x + int(c.x()), rect.y + int(c.y()));
-            }
-            auto tile = tiles.at(grid[c]);
-            font.renderToSurface(
-                string({*get_tile_symbol(grid, tiles, doors, c)}), tile.color,
-                win, rect.x + int(c.x()), rect.y + int(c.y()));
-        }
-}
-
-struct hazard {
-    enum class idents {
-        dart_trap,
-    };
-    struct behavior_bits {
-        static sig const none = 0b1, sling = 0b10, dissipate = 0b100,
-                         lob = 0b1000, blast = 1 << 4;
-    };
-    sig behavior;
-    chrono::seconds activation_time;
-    chrono::seconds tmp_time = 0s; // used to count up
-
-    optional<sig> damage;
-    optional<sig> energy;
-    vector<tile::idents> employed_tiles;
-};
-
-map<tile::idents, hazard> ALL_HAZARDS = {
-    {tile::idents::dart_trap,
-     {
-         .behavior = hazard::behavior_bits::sling,
-         .activation_time = 3s,
-         .employed_tiles = {tile::idents::propelled_dart},
-     }},
-    {tile::idents::bomb_trap,
-     {
-         .behavior = hazard::behavior_bits::lob,
-         .activation_time = 4s,
-         .employed_tiles = {tile::idents::propelled_bomb},
-     }},
-    {tile::idents::propelled_dart,
-     {
-         .behavior = hazard::behavior_bits::none,
-         .activation_time = -1s,
-         .damage = 5,
-         .energy = 10,
-         .employed_tiles = {},
-     }},
-    {tile::idents::propelled_bomb,
-     {
-         .behavior =
-             hazard::behavior_bits::none | hazard::behavior_bits::dissipate,
-         .activation_time = 3s,
-         .damage = 3,
-         .energy = 4,
-         .employed_tiles = {tile::idents::blazing_fire},
-     }},
-    {tile::idents::blazing_fire,
-     {
-         .behavior = hazard::behavior_bits::blast,
-         .activation_time = -1s,
-         .damage = 20,
-         .energy = 3,
-         .employed_tiles = {tile::idents::burned_rubble_pile},
-     }},
-};
-
-struct moving_object {
-    tile::idents tile;
-    plane_coord pos;
-    pair<sig, sig> vel;
-    sig energy;
+/// Where the input of a session comes from, and whether it is shown.
+struct session {
+    optional<input_recorder> recorder;
+    optional<input_replay> replay;
+    bool render = true;   // false: headless replay
+    bool realtime = true; // false: replay as fast as possible
+    sig ticks = 0;        // simulated in all rooms
 };
 
-struct specimen {
-    struct status_bits {
-        static sig const normal = 0b0, dead = 0b1;
-        status_bits() = delete;
-    };
-    sig status = status_bits::normal;
-    plane_coord pos;
-    sig life_points;
-};
+/// Recent p50/p95/p99 of every stage in microseconds, spread over `lines`.
+vector<string> profiler_overlay(frame_profiler const &profiler, size_t lines) {
+    auto r = vector<string>(lines);
+    r[0] = "us ";
+    for (auto i : nums(0_s, profiler.stage_count())) {
+        auto p = profiler.recent(i);
+        r[i * lines / profiler.stage_count()] +=
+            profiler.name(i) + " " + to_string(sig(p.p50)) + "/" +
+            to_string(sig(p.p95)) + "/" + to_string(sig(p.p99)) + "  ";
+    }
+    return r;
+}
 
-tuple<layers, vector<moving_object>, map<plane_coord, hazard>, specimen>
-apply_movement(layers grid, vector<moving_object> moving_objects,
-               map<plane_coord, hazard> active_hazards, specimen player) {
-    for (auto &[tile, pos, vel, energy] : moving_objects) {
-        auto v_x = abs(vel.first), v_y = abs(vel.second);
-        grid[2][pos] = tile::idents::nil;
-        while ((v_x > 0 || v_y > 0) && energy > 0) {
-            energy--;
-            if (v_x > 0) {
-                if (vel.first > 0)
-                    ++pos.x();
-                else if (vel.first < 0)
-                    --pos.x();
-                v_x--;
-            }
-            if (v_y > 0) {
-                if (vel.second > 0)
-                    ++pos.y();
-                else if (vel.second < 0)
-                    --pos.y();
-                v_y--;
-            }
+/// Replaces the info lines shown in `info_areas` by `info`.
+void print_info(vector<string> const &info, Window const &main_win,
+                SDL_Rect const &info_view, Font const &font,
+                vector<SDL_Rect> &info_areas, vector<SDL_Rect> &updated) {
+    for (auto &area : info_areas)
+        main_win.clear({0, 0, 0}, &area);
+    updated.insert(end(updated), begin(info_areas), end(info_areas));
+    info_areas.clear();
+    for (auto i : nums(0_s, info.size()))
+        info_areas.push_back(font.renderToSurface(
+            info[i], color_idents::WHITE_ON_BLACK, main_win, info_view.x,
+            info_view.y + int(i)));
+    updated.insert(end(updated), begin(info_areas), end(info_areas));
+}
 
-            if (pos == player.pos) {
-                auto damage = *ALL_HAZARDS.at(tile).damage;
-                player.life_points -= damage;
-                energy = 0;
-            }
-            if (!tile_satisfies_flags(grid[0], ALL_TILES, pos,
-                                      tile::flag_bits::passable)) {
-                if (ALL_HAZARDS.at(tile).behavior &
-                    hazard::behavior_bits::blast) {
-                    grid[0] =
-                        replace_coords(move(grid[0]), {pos},
-                                       ALL_HAZARDS.at(tile).employed_tiles[0]);
-                    cout << "blasting "<<pos<<"\n";
-                    // if a hazard is blasted, it is destroyed
-                    if (active_hazards.count(pos))
-                        active_hazards.erase(pos);
-                }
-                energy = 0;
-            }
-        }
-        grid[2][pos] = tile;
-        if (energy <= 0) {
-            if (ALL_HAZARDS.count(tile)) {
-                if (ALL_HAZARDS.at(tile).behavior &
-                    hazard::behavior_bits::dissipate) {
-                    /// produce a hazardous effect on dissipation
-                    active_hazards[pos] = ALL_HAZARDS.at(tile);
-                } else
-                    grid[2][pos] = tile::idents::nil;
-            }
-        }
-    }
-    return {move(grid), move(moving_objects), move(active_hazards),
-            move(player)};
+void print_death_screen(Window const &main_win, SDL_Rect const &room_view,
+                        Font const &font) {
+    main_win.clear({75, 50, 50});
+    font.renderToSurface("YOU ARE DEAD -- PRESS RETURN",
+                         color_idents::RED_ON_BLACK, main_win, room_view.x + 1,
+                         room_view.y + 10);
+    main_win.updateWindow();
 }
 
-vector<moving_object>
-prune_stagnant_objects(vector<moving_object> moving_objects) {
-    moving_objects.erase(remove_if(begin(moving_objects), end(moving_objects),
-                                   [](moving_object &m) {
-                                       if ((m.energy <= 0) ||
-                                           m.pos.x().limit_reached() ||
-                                           m.pos.y().limit_reached()) {
-                                           return true;
-                                       }
-                                       return false;
-                                   }),
-                         end(moving_objects));
-    return moving_objects;
+/// What a key asks of the room loop, beyond what apply_key() did itself.
+enum class key_command { none, interact, quit };
+
+/// Moves the player for w/a/s/d and takes a life point for z.
+key_command apply_key(SDL_Keycode key, specimen &player) {
+    if (key == SDLK_w)
+        --player.pos.y();
+    else if (key == SDLK_s)
+        ++player.pos.y();
+    else if (key == SDLK_a)
+        --player.pos.x();
+    else if (key == SDLK_d)
+        ++player.pos.x();
+    else if (key == SDLK_e)
+        return key_command::interact;
+    else if (key == SDLK_q || key == SDLK_UNKNOWN)
+        return key_command::quit;
+    else if (key == SDLK_z)
+        player.life_points--;
+    return key_command::none;
 }
 
-tuple<layers, vector<moving_object>>
-trigger_primed_hazards(map<plane_coord, hazard> const &active_hazards,
-                       layers grid, vector<moving_object> moving_objects,
-                       specimen const &player) {
-    for (auto &[c, a] : active_hazards) {
-        if (a.tmp_time > 0s)
-            continue;
-        if (a.behavior &
-            (hazard::behavior_bits::sling | hazard::behavior_bits::lob)) {
-            // pair<sig, sig> vel = {rand.get(-1, 1), rand.get(-1, 1)};
-            auto v_x = sig(player.pos.x()) - sig(c.x()),
-                 v_y = sig(player.pos.y()) - sig(c.y()),
-                 v_max = max(abs(v_x), abs(v_y));
-            pair<sig, sig> vel = {v_x / v_max, v_y / v_max};
-            auto energy = *ALL_HAZARDS.at(a.employed_tiles[0]).energy;
-            if ((vel.first | vel.second) == 0) // misfire
+/**
+ * Waits up to `timeout` for input and queues the keys that arrive, unless
+ * `queue_keys` is false. Returns whether F3 toggled the profiler, which
+ * happens outside of the simulation and of any recording.
+ */
+bool wait_for_keys(chrono::milliseconds timeout, deque<SDL_Keycode> &keys,
+                   bool queue_keys, frame_profiler &profiler) {
+    SDL_Event event;
+    auto toggled = false;
+    if (SDL_WaitEventTimeout(&event, max(1, int(timeout.count()))))
+        do {
+            if (event.type != SDL_KEYDOWN)
                 continue;
-            moving_objects.push_back({a.employed_tiles[0], c, vel, energy});
-        }
-        if (a.behavior & hazard::behavior_bits::dissipate) {
-            grid[2][c] = tile::idents::nil;
-            auto energy = *ALL_HAZARDS.at(a.employed_tiles[0]).energy;
-            vector<pair<sig, sig>> vels = {{0, -2}, {1, -1}, {2, 0},  {1, 1},
-                                           {0, 2},  {-1, 1}, {-2, 0}, {-1, -1}};
-            for (auto &vel : vels)
-                moving_objects.push_back({a.employed_tiles[0], c, vel, energy});
-        }
-    }
-    return {move(grid), move(moving_objects)};
+            auto key = event.key.keysym.sym;
+            if (key == SDLK_F3) {
+                profiler.enable(!profiler.enabled());
+                toggled = !toggled;
+            } else if (queue_keys && key != SDLK_UNKNOWN)
+                keys.push_back(key);
+        } while (SDL_PollEvent(&event));
+    return toggled;
 }
 
-optional<specimen> display_room(random_gen rand, layers grid,
+optional<specimen> display_room(room_state &state, sig room_id,
                                 map<plane_coord, sig> const &out_doors,
                                 Window const &main_win,
                                 SDL_Rect const &room_view,
                                 SDL_Rect const &info_view, Font const &font,
-                                specimen player, string room_title) {
+                                specimen player, string room_title,
+                                session &io, frame_profiler &profiler) {
+    auto &rand = state.rand;
+    auto &grid = state.room;
+    auto &active_hazards = state.active_hazards;
+    auto &moving_objects = state.moving_objects;
+    auto &timers = state.timers;
+    auto &distances = state.distances;
+    auto &tick_count = state.tick;
+    scope_guard player_guard([&grid] {
+        grid[1] = empty_grid(grid[1].size());
+        for (auto &layer : grid)
+            layer.mark_all_dirty();
+    });
     grid[1][player.pos] = tile::idents::player;
+    distances.retarget(player.pos);
     auto interaction_point = optional<plane_coord>();
     auto info_text = "--- " + room_title + "---";
-    auto active_hazards = map<plane_coord, hazard>();
-    atomic<bool> hazard_ready = false;
-    auto moving_objects = vector<moving_object>();
-    for (auto &c : grid[0]) {
-        if (ALL_HAZARDS.count(grid[0][c])) {
-            active_hazards[c] = ALL_HAZARDS.at(grid[0][c]);
-            active_hazards[c].tmp_time =
-                active_hazards[c].activation_time / rand.get(1, 4);
-        }
+    using sim_clock = chrono::steady_clock;
+    sim_clock::duration const tick = sim_clock::duration(1s) / TICKS_PER_SECOND;
+    sim_clock::duration const frame =
+        sim_clock::duration(1s) / FRAMES_PER_SECOND;
+    auto pending_keys = deque<SDL_Keycode>();
+    auto last_time = sim_clock::now();
+    auto lag = sim_clock::duration::zero();
+    auto next_frame = last_time;
+
+    if (io.render) {
+        main_win.clear({0, 0, 0});
+        main_win.updateWindow();
     }
-    thread heartbeat;
-    atomic<bool> heartbeat_active = false;
-    scope_guard heartbeat_guard;
-    if (!active_hazards.empty())
-        heartbeat = thread([&active_hazards, &hazard_ready, &heartbeat_active] {
-            heartbeat_active = true;
-            while (heartbeat_active) {
-                /// hazard_ready is set when a hazard's tmp_time has become 0.
-                /// If it is still set here, we wait.
-                if (hazard_ready)
-                    continue;
-                this_thread::sleep_for(1s);
-                for (auto &[c, a] : active_hazards) {
-                    a.tmp_time += 1s;
-                    if (a.tmp_time == a.activation_time)
-                        hazard_ready = true, a.tmp_time = 0s;
+    /// per-frame buffers, reused so that a quiet frame does not allocate
+    auto due = vector<plane_coord>();
+    auto updated = vector<SDL_Rect>();
+    auto shown_text = string();
+    auto shown_life_points = optional<sig>();
+    auto info_areas = vector<SDL_Rect>();
+    auto next_overlay = sim_clock::time_point();
+    while (true) {
+        auto now = sim_clock::now();
+        if (io.realtime) {
+            /// a stall of more than a second drops ticks instead of
+            /// replaying them all at once
+            lag = min(lag + (now - last_time), sim_clock::duration(1s));
+            last_time = now;
+        } else
+            lag = tick, next_frame = now;
+        for (; lag >= tick; lag -= tick) {
+            auto prev = player.pos;
+            auto key = optional<SDL_Keycode>();
+            if (io.replay)
+                key = io.replay->key_at(room_id, tick_count);
+            else if (!pending_keys.empty()) {
+                key = pending_keys.front();
+                pending_keys.pop_front();
+                if (io.recorder)
+                    io.recorder->record(room_id, tick_count, *key);
+            }
+            auto command = key ? apply_key(*key, player) : key_command::none;
+            if (command == key_command::quit)
+                return {};
+            if (command == key_command::interact && interaction_point) {
+                auto effect = interact_with(rand, grid[0], *interaction_point);
+                if (effect.flags & interaction_effect::effect_bits::transport) {
+                    player.pos = *interaction_point;
+                    return player;
                 }
+                info_text = *effect.message;
             }
-        }),
-        heartbeat_guard.assign([&heartbeat, &heartbeat_active] {
-            heartbeat_active = false;
-            if (heartbeat.joinable())
-                heartbeat.join();
-        });
 
-    while (true) {
-        main_win.clear({0, 0, 0});
-        print_grid(grid, ALL_TILES, out_doors, main_win, room_view, font);
-        font.renderToSurface(info_text, color_idents::WHITE_ON_BLACK, main_win,
-                             info_view.x, info_view.y);
-        font.renderToSurface("HP: " + to_string(player.life_points) +
-                                 "    XP: 0",
-                             color_idents::WHITE_ON_BLACK, main_win,
-                             info_view.x, info_view.y + 1);
-        main_win.updateWindow();
+            tick_count++;
+            io.ticks++;
+            if (distances.stale()) {
+                auto timer = profiler.time(frame_stages::flow);
+                distances.advance(grid[0], FLOW_FIELD_CELLS_PER_TICK);
+            }
+            {
+                auto timer = profiler.time(frame_stages::hazards);
+                fire_due_hazards(state, player, due);
+            }
+
+            if (player.pos != prev) {
+                if (tile_satisfies_flags(grid[0], player.pos,
+                                         tile::flag_bits::interactable))
+                    interaction_point = player.pos;
+                else
+                    interaction_point = {};
+
+                auto blocked = !tile_satisfies_flags(grid[0], player.pos,
+                                                     tile::flag_bits::passable);
+                if (blocked)
+                    player.pos = prev;
+
+                if (tile_satisfies_flags(grid[0], player.pos,
+                                         tile::flag_bits::transporting)) {
+                    return player;
+                }
+
+                if (!blocked || interaction_point) {
+                    auto described_coord =
+                        interaction_point ? *interaction_point : player.pos;
+                    info_text = get_description(grid[0], ALL_TILES, out_doors,
+                                                described_coord);
+
+                    grid[1][prev] = tile::idents::nil;
+                    grid[1][player.pos] = tile::idents::player;
+                    distances.retarget(player.pos);
+                }
+            }
+
+            if (!moving_objects.empty()) {
+                auto timer = profiler.time(frame_stages::movement);
+                apply_movement(grid, moving_objects, active_hazards,
+                               distances, player, timers, tick_count);
+            }
+        }
+
         if (player.life_points <= 0) {
-            main_win.clear({75, 50, 50});
-            font.renderToSurface("YOU ARE DEAD -- PRESS RETURN",
-                                 color_idents::RED_ON_BLACK, main_win,
-                                 room_view.x + 1, room_view.y + 10);
+            if (io.render)
+                print_death_screen(main_win, room_view, font);
             player.status = specimen::status_bits::dead;
-            main_win.updateWindow();
             return player;
         }
-        SDL_Event event;
-        SDL_WaitEventTimeout(&event, 1000 / FRAMES_PER_SECOND);
-        auto prev = player.pos;
-        if (event.type == SDL_KEYDOWN) {
-            auto key = event.key.keysym.sym;
-            if (key == SDLK_w)
-                --player.pos.y();
-            else if (key == SDLK_s)
-                ++player.pos.y();
-            else if (key == SDLK_a)
-                --player.pos.x();
-            else if (key == SDLK_d)
-                ++player.pos.x();
-            else if (key == SDLK_e && interaction_point) {
-                auto effect =
-                    interact_with(rand, grid[0], ALL_TILES, *interaction_point);
-                info_text = *effect.message;
-                continue;
-            } else if (key == SDLK_q)
-                return {};
-            else if (key == SDLK_z)
-                player.life_points--;
-        }
 
-        if (hazard_ready) {
-            hazard_ready = false;
-            auto &&[_grid, _objects] = trigger_primed_hazards(
-                active_hazards, move(grid), move(moving_objects), player);
-            grid = move(_grid);
-            moving_objects = move(_objects);
+        if (io.render && now >= next_frame) {
+            updated.clear();
+            {
+                auto timer = profiler.time(frame_stages::cells);
+                print_dirty_cells(grid, ALL_TILES, out_doors, main_win,
+                                  room_view, font, updated);
+            }
+            if (profiler.enabled() ? now >= next_overlay
+                                   : info_text != shown_text ||
+                                         player.life_points !=
+                                             shown_life_points) {
+                auto timer = profiler.time(frame_stages::text);
+                auto info =
+                    profiler.enabled()
+                        ? profiler_overlay(profiler, 2)
+                        : vector<string>{info_text,
+                                         "HP: " +
+                                             to_string(player.life_points) +
+                                             "    XP: 0"};
+                print_info(info, main_win, info_view, font, info_areas,
+                           updated);
+                shown_text = info_text;
+                shown_life_points = player.life_points;
+                next_overlay = now + 500ms;
+            }
+            auto timer = profiler.time(frame_stages::present);
+            main_win.updateWindow(updated);
+            next_frame = max(next_frame + frame, now);
         }
 
-        if (player.pos != prev) {
-            if (tile_satisfies_flags(grid[0], ALL_TILES, player.pos,
-                                     tile::flag_bits::interactable))
-                interaction_point = player.pos;
-            else
-                interaction_point = {};
+        if (!io.realtime) {
+            SDL_Event event;
+            while (SDL_PollEvent(&event))
+                ;
+            continue;
+        }
+        /// sleep until the next tick or frame is due, or input arrives
+        auto timer = profiler.time(frame_stages::wait);
+        auto wait = min(next_frame, last_time + tick - lag) - sim_clock::now();
+        if (wait_for_keys(chrono::duration_cast<chrono::milliseconds>(wait),
+                          pending_keys, !io.replay, profiler)) {
+            shown_life_points.reset();
+            next_overlay = {};
+        }
+    }
+}
 
-            if (!tile_satisfies_flags(grid[0], ALL_TILES, player.pos,
-                                      tile::flag_bits::passable)) {
-                player.pos = prev;
-                if (!interaction_point)
-                    continue;
+/**
+ * Lets the player roam a chunked room until they quit or die. The camera
+ * follows the player, and only the chunks in and around its view are
+ * loaded, simulated and drawn, so neither the cost of a frame nor the memory
+ * held depend on the size of the room.
+ */
+optional<specimen> explore_large_room(chunked_room &room,
+                                      Window const &main_win,
+                                      SDL_Rect const &room_view,
+                                      SDL_Rect const &info_view,
+                                      Font const &font, specimen player,
+                                      frame_profiler &profiler) {
+    using sim_clock = chrono::steady_clock;
+    sim_clock::duration const tick = sim_clock::duration(1s) / TICKS_PER_SECOND;
+    sim_clock::duration const frame =
+        sim_clock::duration(1s) / FRAMES_PER_SECOND;
+    auto pending_keys = deque<SDL_Keycode>();
+    auto last_time = sim_clock::now();
+    auto lag = sim_clock::duration::zero();
+    auto next_frame = last_time;
+
+    auto view = camera{.x = sig(player.pos.x()) - room_view.w / 2,
+                       .y = sig(player.pos.y()) - room_view.h / 2,
+                       .w = room_view.w,
+                       .h = room_view.h};
+    /// chunks within a chunk of the view are simulated, within two kept
+    auto follow_player = [&] {
+        auto scrolled = view.follow(player.pos.x(), player.pos.y(),
+                                    min(view.w, view.h) / 4, room.size());
+        room.load(view.x - CHUNK_SIZE, view.y - CHUNK_SIZE,
+                  view.x + view.w + CHUNK_SIZE - 1,
+                  view.y + view.h + CHUNK_SIZE - 1);
+        room.evict_outside(view.x - 2 * CHUNK_SIZE, view.y - 2 * CHUNK_SIZE,
+                           view.x + view.w + 2 * CHUNK_SIZE - 1,
+                           view.y + view.h + 2 * CHUNK_SIZE - 1);
+        return scrolled;
+    };
+    follow_player();
+    room.set(1, player.pos, tile::idents::player);
+
+    auto due = vector<plane_coord>();
+    auto updated = vector<SDL_Rect>();
+    auto info_areas = vector<SDL_Rect>();
+    auto redraw = true, show_info = true;
+    auto next_overlay = sim_clock::time_point();
+    while (true) {
+        auto now = sim_clock::now();
+        lag = min(lag + (now - last_time), sim_clock::duration(1s));
+        last_time = now;
+        for (; lag >= tick; lag -= tick) {
+            auto prev = player.pos;
+            if (!pending_keys.empty()) {
+                auto key = pending_keys.front();
+                pending_keys.pop_front();
+                if (apply_key(key, player) == key_command::quit)
+                    return {};
             }
-
-            if (tile_satisfies_flags(grid[0], ALL_TILES, player.pos,
-                                     tile::flag_bits::transporting)) {
-                return player;
+            if (player.pos != prev) {
+                if (!room.has_flags(player.pos, tile::flag_bits::passable))
+                    player.pos = prev;
+                else {
+                    room.set(1, prev, tile::idents::nil);
+                    room.set(1, player.pos, tile::idents::player);
+                    redraw = follow_player() || redraw;
+                    show_info = true;
+                }
             }
 
-            auto described_coord =
-                interaction_point ? *interaction_point : player.pos;
-            info_text =
-                get_description(grid[0], ALL_TILES, out_doors, described_coord);
+            auto timer = profiler.time(frame_stages::hazards);
+            room.simulate(view.x - CHUNK_SIZE, view.y - CHUNK_SIZE,
+                          view.x + view.w + CHUNK_SIZE - 1,
+                          view.y + view.h + CHUNK_SIZE - 1, player, due);
+        }
 
-            grid[1][prev] = tile::idents::nil;
-            grid[1][player.pos] = tile::idents::player;
+        if (player.life_points <= 0) {
+            print_death_screen(main_win, room_view, font);
+            player.status = specimen::status_bits::dead;
+            return player;
         }
 
-        if (!moving_objects.empty()) {
-            auto &&[_grid, _objects, _hazards, _player] =
-                apply_movement(move(grid), move(moving_objects),
-                               move(active_hazards), move(player));
-            grid = move(_grid);
-            moving_objects = prune_stagnant_objects(move(_objects));
-            active_hazards = move(_hazards);
-            player = move(_player);
+        if (now >= next_frame) {
+            updated.clear();
+            if (redraw) {
+                main_win.clear({0, 0, 0});
+                info_areas.clear();
+                show_info = true;
+            }
+            {
+                auto timer = profiler.time(frame_stages::cells);
+                room.for_each_chunk(
+                    view.x - CHUNK_SIZE, view.y - CHUNK_SIZE,
+                    view.x + view.w + CHUNK_SIZE - 1,
+                    view.y + view.h + CHUNK_SIZE - 1,
+                    [&](chunked_room::chunk &c) {
+                        print_chunk_cells(c.state.room, c.x, c.y, view,
+                                          ALL_TILES, main_win, room_view,
+                                          font, redraw, updated);
+                    });
+            }
+            if (profiler.enabled() ? now >= next_overlay : show_info) {
+                auto timer = profiler.time(frame_stages::text);
+                auto info =
+                    profiler.enabled()
+                        ? profiler_overlay(profiler, 2)
+                        : vector<string>{
+                              "(" + to_string(sig(player.pos.x())) + "," +
+                                  to_string(sig(player.pos.y())) + ")  " +
+                                  to_string(room.loaded()) + " chunks",
+                              "HP: " + to_string(player.life_points)};
+                print_info(info, main_win, info_view, font, info_areas,
+                           updated);
+                show_info = false;
+                next_overlay = now + 500ms;
+            }
+            auto timer = profiler.time(frame_stages::present);
+            if (redraw)
+                main_win.updateWindow();
+            else
+                main_win.updateWindow(updated);
+            redraw = false;
+            next_frame = max(next_frame + frame, now);
         }
+
+        auto timer = profiler.time(frame_stages::wait);
+        auto wait = min(next_frame, last_time + tick - lag) - sim_clock::now();
+        if (wait_for_keys(chrono::duration_cast<chrono::milliseconds>(wait),
+                          pending_keys, true, profiler))
+            show_info = true, next_overlay = {};
     }
 }
 
-int main() {
+void write_profile(frame_profiler const &profiler, string const &path) {
+    ofstream o(path);
+    if (path.size() >= 4 && path.compare(path.size() - 4, 4, ".csv") == 0)
+        profiler.write_csv(o);
+    else
+        profiler.write_json(o);
+}
+
+/// Usage: generator [world file] [--profile FILE]
+///        generator --record FILE [--profile FILE]
+///        generator --replay FILE [--fast] [--headless] [--profile FILE]
+///        generator --large SIZE [--profile FILE]
+/// With a world file, the game resumes from it and saves to it on quit; a
+/// file that exists but is no world save is left alone.
+/// A recorded session always starts a new world and can be replayed in real
+/// time, or as fast as possible; a headless replay draws nothing.
+/// --large lets the player roam a single chunked room of SIZE x SIZE cells.
+/// --profile times the frame stages from the start and writes their
+/// histograms on exit (CSV if FILE ends in .csv, JSON otherwise). F3 toggles
+/// the profiler and its overlay at any time.
+int main(int argc, char **argv) {
     auto const window_size = 60;
+    auto world_path = optional<string>();
+    auto record_path = optional<string>(), replay_path = optional<string>();
+    auto profile_path = optional<string>();
+    auto large_size = optional<sig>();
+    auto io = session();
+    frame_profiler profiler(FRAME_STAGE_NAMES);
+    auto usage = [argv] {
+        cerr << "usage: " << argv[0]
+             << " [world file] | --record FILE |"
+                " --replay FILE [--fast] [--headless] | --large SIZE"
+                " [--profile FILE]\n";
+        return 1;
+    };
+    for (auto i = 1; i < argc; i++) {
+        auto has_value = i + 1 < argc;
+        if (!strcmp(argv[i], "--record") && has_value)
+            record_path = argv[++i];
+        else if (!strcmp(argv[i], "--replay") && has_value)
+            replay_path = argv[++i];
+        else if (!strcmp(argv[i], "--large") && has_value)
+            large_size = strtoll(argv[++i], nullptr, 10);
+        else if (!strcmp(argv[i], "--profile") && has_value)
+            profile_path = argv[++i];
+        else if (!strcmp(argv[i], "--fast"))
+            io.realtime = false;
+        else if (!strcmp(argv[i], "--headless"))
+            io.render = false;
+        else if (argv[i][0] != '-' && !world_path)
+            world_path = argv[i];
+        else
+            return usage();
+    }
+    if (int(bool(world_path)) + bool(record_path) + bool(replay_path) +
+                bool(large_size) >
+            1 ||
+        (!replay_path && !(io.realtime && io.render)) ||
+        (large_size && *large_size < 3))
+        return usage();
+    profiler.enable(bool(profile_path));
+    if (replay_path) {
+        io.replay.emplace(*replay_path);
+        if (!io.replay->ok())
+            return 1;
+    }
+    if (!io.render)
+        setenv("SDL_VIDEODRIVER", "dummy", 1);
     Init _init(SDL_INIT_VIDEO);
     assert_true(TTF_Init() == 0, "TTF init failed");
     Font font("NotoMono-Regular.ttf", 24);
     auto const font_size = font.height();
     Window main_win(font_size * window_size / 2, font_size * window_size / 2,
                     "Hello", SDL_WINDOW_INPUT_FOCUS);
-
-    auto seed = random_device()();
+    for (auto i : nums(0_s, tile::ident_count))
+        if (auto ident = tile::idents(i); ALL_TILES.contains(ident))
+            font.cacheGlyph(ALL_TILES[ident].symbol, ALL_TILES[ident].color,
+                            static_cast<SDL_Surface *>(main_win)->format);
+
+    auto seed = io.replay ? static_cast<random_device::result_type>(
+                                io.replay->seed())
+                          : random_device()();
     auto room_id = sig(0);
     auto latest_visited_room = optional<sig>();
     auto next_free_room = sig(1);
     specimen player = {.pos = {0, 0, 0, 0}, .life_points = 100};
+    if (large_size) {
+        auto room = chunked_room(seed, *large_size);
+        auto room_view = SDL_Rect{
+            .x = 0, .y = 0, .w = window_size / 2, .h = window_size / 2 - 3};
+        auto info_view = SDL_Rect{
+            .x = 0, .y = room_view.h + 1, .w = window_size / 2, .h = 2};
+        player.pos = plane_coord(*large_size / 2, *large_size / 2,
+                                 *large_size - 1, 0);
+        explore_large_room(room, main_win, room_view, info_view, font,
+                           move(player), profiler);
+        cout << "chunks: " << room.loaded() << " loaded, "
+             << room.memory_footprint() / 1024 << " KiB\n";
+        if (profile_path)
+            write_profile(profiler, *profile_path);
+        return 0;
+    }
     map<sig, map<plane_coord, sig>> room_network;
+    /// the door a room was first entered through becomes a sliding door
+    map<sig, plane_coord> entrances;
+    auto saved_world = optional<world_file>();
+    if (world_path) {
+        saved_world.emplace(*world_path);
+        if (saved_world->exists() && !saved_world->ok()) {
+            cerr << *world_path
+                 << ": not a readable world save, refusing to overwrite it\n";
+            return 1;
+        }
+    }
+    if (saved_world && saved_world->ok()) {
+        auto &header = saved_world->header();
+        seed = static_cast<decltype(seed)>(header.seed);
+        room_id = header.current_room;
+        if (header.previous_room >= 0)
+            latest_visited_room = header.previous_room;
+        next_free_room = header.next_free_room;
+        player.life_points = header.life_points;
+        room_network = saved_world->room_network();
+        entrances = saved_world->entrances();
+    }
+    if (record_path) {
+        io.recorder.emplace(*record_path, seed);
+        if (!io.recorder->ok()) {
+            cerr << *record_path << ": cannot write the recording\n";
+            return 1;
+        }
+    }
+    auto const started = chrono::steady_clock::now();
+    auto exit_status = 0;
+    room_pool pregenerated(seed, window_size);
+    lru_cache<sig, room_state> visited_rooms(ROOM_CACHE_BUDGET,
+                                             memory_footprint);
     while (true) {
-        room_network[room_id] = {};
-        random_gen rand(seed + static_cast<decltype(seed)>(room_id));
-        auto const grid_size =
-            sig(rand.get(window_size / 4, window_size / 3) + 5);
+        auto state = visited_rooms.take(room_id);
+        if (!state && saved_world && saved_world->ok())
+            if (auto saved = saved_world->load_room(room_id))
+                state = make_room_state(random_gen(seed).split(nat(room_id)),
+                                        move(*saved));
+        if (!state) {
+            auto [rand, grid_size, grid, doors] = pregenerated.take(room_id);
+            if (!room_network.count(room_id)) {
+                room_network[room_id] = {};
+                if (latest_visited_room) {
+                    room_network[room_id][doors.back()] = *latest_visited_room;
+                    entrances.emplace(room_id, doors.back());
+                    doors.pop_back();
+                }
+                for (auto &&c_door : move(doors)) {
+                    room_network.at(room_id)[c_door] = next_free_room;
+                    next_free_room++;
+                }
+            }
+            if (entrances.count(room_id))
+                grid[0][entrances.at(room_id)] = tile::idents::sliding_door;
+            state = make_room_state(move(rand), move(grid));
+        }
+        auto const grid_size = state->room[0].size();
         /// ATTENTION: The rects should only be accessed via
         /// font.renderToSurface()! Otherwise the actual pixel size of the
         /// font has to be considered when drawing something "by hand". That
@@ -477,34 +660,79 @@ int main() {
             SDL_Rect{.x = 0, .y = room_view.h + 1, .w = window_size, .h = 2};
 
         main_win.updateWindow();
-        auto &&[grid, doors] = build_room(rand, grid_size);
-        player.pos = plane_coord(grid[0].size() / 2, grid[0].size() / 2,
-                                 grid[0].size() - 1, 0);
-        if (latest_visited_room) {
-            room_network[room_id][doors.back()] = *latest_visited_room;
-            grid[0][doors.back()] = tile::idents::sliding_door;
-            player.pos = *find_adjoining_tile(grid[0], ALL_TILES, doors.back(),
-                                              tile::idents::doorway_sigil);
-            doors.pop_back();
-        }
-        for (auto &&c_door : move(doors)) {
-            room_network.at(room_id)[c_door] = next_free_room;
-            next_free_room++;
+        player.pos = room_spawn(grid_size);
+        auto neighbours = vector<sig>();
+        for (auto &[c_door, id] : room_network.at(room_id)) {
+            if (id == latest_visited_room)
+                player.pos = *find_adjoining_tile(state->room[0], c_door,
+                                                  tile::idents::doorway_sigil);
+            if (!visited_rooms.contains(id))
+                neighbours.push_back(id);
         }
+        pregenerated.prefetch(neighbours);
         auto o_player = display_room(
-            rand, move(grid), room_network[room_id], main_win, room_view,
-            info_view, font, move(player), "Room " + to_string(room_id));
-        if (!o_player)
+            *state, room_id, room_network.at(room_id), main_win, room_view,
+            info_view, font, move(player), "Room " + to_string(room_id), io,
+            profiler);
+        if (io.recorder &&
+            (!o_player || o_player->status == specimen::status_bits::dead))
+            io.recorder->end(room_id, state->tick);
+        visited_rooms.put(room_id, move(*state));
+        if (!o_player) {
+            if (world_path &&
+                !save_world(
+                    *world_path,
+                    {.seed = seed,
+                     .current_room = room_id,
+                     .previous_room = latest_visited_room.value_or(-1),
+                     .next_free_room = next_free_room,
+                     .life_points = player.life_points},
+                    room_network, entrances, [&](sig id) {
+                        if (auto *cached = visited_rooms.peek(id)) {
+                            // projectiles in flight are not saved, so
+                            // neither are their glyphs
+                            auto room = cached->room;
+                            room.at(2) = empty_grid(room[2].size());
+                            return room;
+                        }
+                        if (saved_world && saved_world->ok())
+                            if (auto saved = saved_world->load_room(id))
+                                return *saved;
+                        auto room = generate_room(seed, id, window_size).room;
+                        if (entrances.count(id))
+                            room[0][entrances.at(id)] =
+                                tile::idents::sliding_door;
+                        return room;
+                    })) {
+                cerr << *world_path << ": cannot save the world\n";
+                exit_status = 1;
+            }
             break;
+        }
         player = *o_player;
         if (player.status == specimen::status_bits::dead) {
             SDL_Event event;
-            while (!SDL_PollEvent(&event) || event.type != SDL_KEYDOWN ||
-                   event.key.keysym.sym != SDLK_RETURN)
+            while (!io.replay &&
+                   (!SDL_PollEvent(&event) || event.type != SDL_KEYDOWN ||
+                    event.key.keysym.sym != SDLK_RETURN))
                 ;
             break;
         }
         latest_visited_room = room_id;
         room_id = room_network.at(room_id).at(player.pos);
     }
+    cout << "room cache: " << visited_rooms.hits() << " hits, "
+         << visited_rooms.misses() << " misses\n";
+    cout << "room generation: " << room_generation.rooms << " rooms, "
+         << 100 * room_generation.rejection_rate() << "% rejected\n";
+    if (profile_path)
+        write_profile(profiler, *profile_path);
+    if (io.replay) {
+        auto seconds = chrono::duration<double>(chrono::steady_clock::now() -
+                                                started)
+                           .count();
+        cout << "replay: " << io.ticks << " ticks in " << seconds << " s ("
+             << double(io.ticks) / seconds << " ticks/sec)\n";
+    }
+    return exit_status;
 }
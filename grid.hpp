@@ -3,18 +3,53 @@
 #include "coord.hpp"
 #include "tile.hpp"
 
+/// Non-owning view of a contiguous run of cells (e.g. one grid row).
+template <class T> class cell_span {
+    T *data_;
+    sig size_;
+
+  public:
+    cell_span(T *data, sig size) : data_(data), size_(size) {}
+    template <class C>
+    cell_span(C &c) : data_(c.data()), size_(sig(c.size())) {}
+    auto begin() const { return data_; }
+    auto end() const { return data_ + size_; }
+    auto &operator[](sig i) const { return data_[i]; }
+    auto data() const { return data_; }
+    sig size() const { return size_; }
+};
+
+/**
+ * Square grid of tiles, stored as a single row-major buffer.
+ * If padded, every row is widened to a multiple of the cache line size. The
+ * padding cells are never visible through the accessors.
+ *
+ * The grid records which cells have changed since the last clear_dirty() so
+ * that only those need to be redrawn. Any mutable access through at() or
+ * operator[] counts as a change; the raw_cell()/raw_row() accessors do not and
+ * are only meant for building a grid. A fresh grid starts out entirely dirty.
+ *
+ * The mutators set(), fill(), apply_mask() work in place and do not allocate
+ * once the grid's change records have grown to their working size.
+ *
+ * For every tile::flag_bits flag, the grid also derives a bitplane with one
+ * bit per cell. The planes are built on the first flag query and then kept
+ * up to date from the cells changed since the previous query.
+ */
 class grid {
-    vector<vector<tile::idents>> layers_;
-    class row_ref {
-        vector<char> &row_;
+    static constexpr sig CACHE_LINE_CELLS = 64 / sizeof(tile::idents);
+    sig size_, stride_;
+    vector<tile::idents> cells_;
+    bool all_dirty_ = true;
+    vector<bool> dirty_mask_;
+    vector<pair<sig, sig>> dirty_;
+
+    static constexpr sig FLAG_PLANES = 5;
+    sig words_per_row_;
+    mutable vector<uint64_t> flag_bits_; // [plane][y][x / 64]
+    mutable bool flags_valid_ = false;
+    mutable vector<pair<sig, sig>> flag_pending_;
 
-      public:
-        template <class R>
-        row_ref(R &row) : row_(const_cast<decltype(row_)>(row)) {}
-        operator decltype(row_) &() { return row_; }
-        auto &operator[](sig j) { return row_[static_cast<size_t>(j)]; }
-        auto &operator[](sig j) const { return row_[static_cast<size_t>(j)]; }
-    };
     class grid_iterator {
         plane_coord pos_;
         sig max_;
@@ -39,22 +74,190 @@ class grid {
         auto operator!=(bool ended) const { return ended_ != ended; }
     };
 
-  public:
-    grid(decltype(layers_) layers) : layers_(layers) {}
-    auto operator[](plane_coord const &p) const {
-        return layers_.at(size_t(p.y())).at(size_t(p.x()));
+    size_t index(sig x, sig y) const { return size_t(y * stride_ + x); }
+    size_t checked_index(sig x, sig y) const {
+        if (x < 0 || y < 0 || x >= size_ || y >= size_) {
+            cerr << "grid: cell (" << x << "," << y << ") out of range [0,"
+                 << size_ << ")\n";
+            terminate();
+        }
+        return index(x, y);
     }
-    auto &operator[](plane_coord const &p) {
-        return layers_.at(size_t(p.y())).at(size_t(p.x()));
+
+    void touch(sig x, sig y) {
+        mark_dirty(x, y);
+        if (sig(flag_pending_.size()) > size_ * size_ / 4)
+            flags_valid_ = false, flag_pending_.clear();
+        else if (flags_valid_)
+            flag_pending_.push_back({x, y});
+    }
+
+    size_t flag_word(sig plane, sig x, sig y) const {
+        return size_t((plane * size_ + y) * words_per_row_ + x / 64);
+    }
+    void update_flag_bits(sig x, sig y) const {
+        auto flags = ALL_TILES[cells_[index(x, y)]].flags;
+        auto bit = uint64_t(1) << (x % 64);
+        for (sig plane = 0; plane < FLAG_PLANES; plane++) {
+            auto &word = flag_bits_[flag_word(plane, x, y)];
+            word = (flags >> plane & 1) ? word | bit : word & ~bit;
+        }
+    }
+    /// Cheap when nothing changed, as passable_tiles() calls it per cell.
+    void sync_flags() const {
+        if (flags_valid_ && flag_pending_.empty())
+            return;
+        apply_flag_changes();
+    }
+    void apply_flag_changes() const {
+        if (!flags_valid_) {
+            flag_bits_.assign(size_t(FLAG_PLANES * size_ * words_per_row_), 0);
+            for (sig y = 0; y < size_; y++)
+                for (sig x = 0; x < size_; x++)
+                    update_flag_bits(x, y);
+            flags_valid_ = true;
+        } else
+            for (auto &[x, y] : flag_pending_)
+                update_flag_bits(x, y);
+        flag_pending_.clear();
+    }
+
+  public:
+    grid(sig size, tile::idents fill = tile::idents::nil, bool padded = false)
+        : size_(size),
+          stride_(padded ? (size + CACHE_LINE_CELLS - 1) / CACHE_LINE_CELLS *
+                               CACHE_LINE_CELLS
+                         : size),
+          cells_(size_t(stride_ * size_), fill),
+          dirty_mask_(size_t(size_ * size_)),
+          words_per_row_((size + 63) / 64) {}
+
+    /// Checked access, terminates if (x,y) lies outside the grid.
+    auto at(sig x, sig y) const { return cells_[checked_index(x, y)]; }
+    auto &at(sig x, sig y) {
+        auto i = checked_index(x, y);
+        touch(x, y);
+        return cells_[i];
     }
+    /// Unchecked access for hot loops.
+    auto cell(sig x, sig y) const { return cells_[index(x, y)]; }
+
+    auto operator[](plane_coord const &p) const { return at(p.x(), p.y()); }
+    auto &operator[](plane_coord const &p) { return at(p.x(), p.y()); }
     auto operator[](pair<sig, sig> p) const {
         return operator[](plane_coord(p.first, p.second, size() - 1, 0));
     }
     auto &operator[](pair<sig, sig> p) {
         return operator[](plane_coord(p.first, p.second, size() - 1, 0));
     }
-    auto begin() const { return grid_iterator(0, 0, sig(layers_.size()) - 1); };
+
+    auto row(sig y) const {
+        return cell_span<tile::idents const>(&cells_[index(0, y)], size_);
+    }
+    /**
+     * Writable access that bypasses the change records. Only for filling a
+     * grid before anyone has looked at it: a fresh grid is entirely dirty
+     * and has no flag planes yet.
+     */
+    auto &raw_cell(sig x, sig y) { return cells_[index(x, y)]; }
+    auto raw_row(sig y) {
+        return cell_span<tile::idents>(&cells_[index(0, y)], size_);
+    }
+
+    void set(sig x, sig y, tile::idents t) { at(x, y) = t; }
+    /// Writes `t` to every given cell.
+    void set(cell_span<plane_coord const> coords, tile::idents t) {
+        for (auto &c : coords)
+            at(c.x(), c.y()) = t;
+    }
+    /// Writes `t` to every cell in [x0,x1]x[y0,y1].
+    void fill(sig x0, sig y0, sig x1, sig y1, tile::idents t) {
+        checked_index(x0, y0), checked_index(x1, y1);
+        for (sig y = y0; y <= y1; y++)
+            for (sig x = x0; x <= x1; x++)
+                cells_[index(x, y)] = t, touch(x, y);
+    }
+    /**
+     * Writes `t` to every cell whose bit is set in `mask`, which is laid out
+     * like flag_row(): words_per_row() words per row, bit x % 64 of word
+     * x / 64.
+     */
+    void apply_mask(cell_span<uint64_t const> mask, tile::idents t) {
+        for (sig y = 0; y < size_; y++)
+            for (sig w = 0; w < words_per_row_; w++)
+                for (auto bits = mask[y * words_per_row_ + w]; bits;
+                     bits &= bits - 1) {
+                    auto x = w * 64 + sig(__builtin_ctzll(bits));
+                    if (x < size_)
+                        cells_[index(x, y)] = t, touch(x, y);
+                }
+    }
+
+    void mark_dirty(sig x, sig y) {
+        auto i = size_t(y * size_ + x);
+        if (all_dirty_ || dirty_mask_[i])
+            return;
+        dirty_mask_[i] = true;
+        dirty_.push_back({x, y});
+    }
+    void mark_all_dirty() { all_dirty_ = true, flags_valid_ = false; }
+    void clear_dirty() {
+        for (auto &[x, y] : dirty_)
+            dirty_mask_[size_t(y * size_ + x)] = false;
+        dirty_.clear();
+        all_dirty_ = false;
+    }
+    bool all_dirty() const { return all_dirty_; }
+    /// Cells changed since the last clear_dirty(), unless all_dirty() is set.
+    auto &dirty_cells() const { return dirty_; }
+
+    /// Whether the tile at (x,y) has any of the given tile::flag_bits.
+    bool has_flags(sig x, sig y, sig flags) const {
+        sync_flags();
+        for (sig plane = 0; plane < FLAG_PLANES; plane++)
+            if ((flags >> plane & 1) &&
+                (flag_bits_[flag_word(plane, x, y)] >> (x % 64) & 1))
+                return true;
+        return false;
+    }
+    /// Whether any cell in [x0,x1]x[y0,y1] has one of the given flags.
+    bool any_flags(sig x0, sig y0, sig x1, sig y1, sig flags) const {
+        sync_flags();
+        for (sig plane = 0; plane < FLAG_PLANES; plane++) {
+            if (!(flags >> plane & 1))
+                continue;
+            for (sig y = y0; y <= y1; y++)
+                for (auto w = x0 / 64; w <= x1 / 64; w++) {
+                    auto mask = ~uint64_t(0);
+                    if (w == x0 / 64)
+                        mask &= ~uint64_t(0) << (x0 % 64);
+                    if (w == x1 / 64)
+                        mask &= ~uint64_t(0) >> (63 - x1 % 64);
+                    if (flag_bits_[flag_word(plane, w * 64, y)] & mask)
+                        return true;
+                }
+        }
+        return false;
+    }
+    /// Row y of the bitplane for a single flag: bit x % 64 of word x / 64.
+    auto flag_row(sig flag, sig y) const {
+        sync_flags();
+        auto plane = sig(0);
+        while (flag >> (plane + 1))
+            plane++;
+        return cell_span<uint64_t const>(&flag_bits_[flag_word(plane, 0, y)],
+                                         words_per_row_);
+    }
+
+    auto begin() const { return grid_iterator(0, 0, size_ - 1); };
     auto end() const { return true; }
-    sig size() const { return static_cast<sig>(layers_.size()); }
+    sig size() const { return size_; }
+    sig stride() const { return stride_; }
+    sig words_per_row() const { return words_per_row_; }
 };
 using layers = vector<grid>;
+
+bool tile_satisfies_flags(grid const &grid, plane_coord const &coord,
+                          sig flags) {
+    return grid.has_flags(coord.x(), coord.y(), flags);
+}
@@ -0,0 +1,103 @@
+#pragma once
+#include <_main.hpp>
+#include <cstring>
+
+/**
+ * Recorded input of a play session:
+ *
+ *      input_header
+ *      input_event[...]        in the order the keys were applied
+ *
+ * Keys are stored with the room and the simulation tick that applied them,
+ * so a replay does not depend on timing. A key of 0 marks the end of the
+ * session. All integers are stored in native byte order.
+ */
+struct input_header {
+    static constexpr char MAGIC[8] = "PGINPUT";
+    static constexpr uint32_t VERSION = 1;
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t seed;
+};
+
+struct input_event {
+    int32_t room;
+    uint32_t tick;
+    int32_t key;
+};
+
+static_assert(sizeof(input_header) == 24);
+static_assert(sizeof(input_event) == 12);
+
+class input_recorder {
+    ofstream out_;
+
+  public:
+    input_recorder(string const &path, uint64_t seed)
+        : out_(path, ios::binary) {
+        input_header header = {};
+        memcpy(header.magic, input_header::MAGIC, 8);
+        header.version = input_header::VERSION;
+        header.seed = seed;
+        out_.write(reinterpret_cast<char const *>(&header), sizeof(header));
+    }
+
+    bool ok() const { return bool(out_); }
+    void record(sig room, sig tick, int32_t key) {
+        input_event e = {int32_t(room), uint32_t(tick), key};
+        out_.write(reinterpret_cast<char const *>(&e), sizeof(e));
+    }
+    void end(sig room, sig tick) {
+        record(room, tick, 0);
+        out_.flush();
+    }
+};
+
+class input_replay {
+    uint64_t seed_ = 0;
+    vector<input_event> events_;
+    size_t next_ = 0;
+    bool ok_ = false;
+
+  public:
+    explicit input_replay(string const &path) {
+        ifstream in(path, ios::binary);
+        input_header header;
+        if (!in.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+            memcmp(header.magic, input_header::MAGIC, 8) ||
+            header.version != input_header::VERSION) {
+            cerr << path << ": not an input recording of version "
+                 << input_header::VERSION << "\n";
+            return;
+        }
+        seed_ = header.seed;
+        input_event e;
+        while (in.read(reinterpret_cast<char *>(&e), sizeof(e)))
+            events_.push_back(e);
+        ok_ = true;
+    }
+
+    bool ok() const { return ok_; }
+    uint64_t seed() const { return seed_; }
+    /// Whether every event has been replayed (or the session has ended).
+    bool done() const { return next_ == events_.size(); }
+    size_t event_count() const { return events_.size(); }
+
+    /// The key applied at `tick` in `room`; 0 ends the session.
+    optional<int32_t> key_at(sig room, sig tick) {
+        if (done())
+            return 0;
+        auto &e = events_[next_];
+        if (e.room == room && e.tick < uint64_t(tick)) {
+            cerr << "replay: lost sync in room " << room << " at tick " << tick
+                 << "\n";
+            next_ = events_.size();
+            return 0;
+        }
+        if (e.room != room || e.tick != uint64_t(tick))
+            return {};
+        next_++;
+        return e.key;
+    }
+};
@@ -0,0 +1,418 @@
+/**
+ * Microbenchmarks of the generation, simulation, graph and render hot paths.
+ *
+ * Usage: microbench [--filter TEXT] [--out FILE] [--baseline FILE]
+ *                   [--tolerance PERCENT]
+ *
+ * Every benchmark is repeated for at least MIN_TIME and reports ns/op,
+ * heap allocations/op and, where perf events are available, cache
+ * misses/op. Only the benchmarked call is measured; resetting its input
+ * between two calls is not. Results are written as JSON with one benchmark
+ * per line, so that two runs can be diffed. Given a baseline, every
+ * benchmark that became slower by more than the tolerance (default 10%) is
+ * reported and the exit status is 1.
+ */
+#include <_main.hpp>
+#include <alloc_count.hpp>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <linux/perf_event.h>
+#include <sdl_wrap.hpp>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "builder.hpp"
+#include "cell_graph.hpp"
+#include "flow_field.hpp"
+#include "grid.hpp"
+#include "render.hpp"
+#include "simulation.hpp"
+#include "tile.hpp"
+
+/// Keeps benchmarked results alive.
+volatile size_t sink = 0;
+
+auto const MIN_TIME = chrono::milliseconds(200);
+
+/// Hardware cache misses of this thread, if the kernel allows counting them.
+class cache_miss_counter {
+    int fd_ = -1;
+
+  public:
+    cache_miss_counter() {
+        perf_event_attr attr = {};
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = uint32_t(sizeof(attr));
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd_ = int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+    }
+    ~cache_miss_counter() {
+        if (fd_ >= 0)
+            close(fd_);
+    }
+    cache_miss_counter(cache_miss_counter const &) = delete;
+    cache_miss_counter &operator=(cache_miss_counter const &) = delete;
+
+    bool available() const { return fd_ >= 0; }
+    void start() {
+        if (fd_ < 0)
+            return;
+        ioctl(fd_, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    nat stop() {
+        auto r = uint64_t(0);
+        if (fd_ < 0)
+            return 0;
+        ioctl(fd_, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(fd_, &r, sizeof(r)) != ssize_t(sizeof(r)))
+            return 0;
+        return r;
+    }
+};
+
+struct result {
+    string name;
+    nat ops;
+    double ns_per_op, allocs_per_op;
+    optional<double> misses_per_op;
+};
+
+class bench_runner {
+    string filter_;
+    cache_miss_counter misses_;
+
+  public:
+    vector<result> results;
+
+    explicit bench_runner(string filter) : filter_(move(filter)) {}
+
+    bool selected(string const &name) const {
+        return name.find(filter_) != string::npos;
+    }
+
+    /// Measures `op`; `reset` restores its input before every call.
+    template <class Reset, class Op>
+    void run(string const &name, Reset reset, Op op) {
+        if (!selected(name))
+            return;
+        auto ops = nat(0), allocations = nat(0), misses = nat(0);
+        auto elapsed = chrono::steady_clock::duration::zero();
+        while (ops < 3 || elapsed < MIN_TIME) {
+            reset();
+            misses_.start();
+            auto allocations_before = allocation_count.load();
+            auto start = chrono::steady_clock::now();
+            op();
+            elapsed += chrono::steady_clock::now() - start;
+            allocations += allocation_count.load() - allocations_before;
+            misses += misses_.stop();
+            ops++;
+        }
+        auto per_op = [ops](double x) { return x / double(ops); };
+        results.push_back(
+            {name, ops,
+             per_op(double(
+                 chrono::duration_cast<chrono::nanoseconds>(elapsed).count())),
+             per_op(double(allocations)),
+             misses_.available() ? optional(per_op(double(misses)))
+                                 : nullopt});
+        auto &r = results.back();
+        cout << left << setw(36) << r.name << right << setw(14) << fixed
+             << setprecision(1) << r.ns_per_op << " ns/op" << setw(10)
+             << r.allocs_per_op << " allocs/op";
+        if (r.misses_per_op)
+            cout << setw(12) << *r.misses_per_op << " misses/op";
+        cout << "\n";
+    }
+    template <class Op> void run(string const &name, Op op) {
+        run(name, [] {}, move(op));
+    }
+};
+
+/// A walled room of plain floor, with its flag bitplanes already built.
+layers floor_room(sig size) {
+    auto room = layers{grid(size, tile::idents::wall), grid(size),
+                       grid(size)};
+    room[0].fill(1, 1, size - 2, size - 2, tile::idents::stone_flooring);
+    room[0].has_flags(0, 0, tile::flag_bits::none); // build the bitplanes
+    return room;
+}
+
+/// The size x size cell grid as a 4-connected graph.
+graph grid_graph(sig size) {
+    auto n = int(size);
+    graph g(n * n);
+    for (auto y = 0; y < n; y++)
+        for (auto x = 0; x < n; x++) {
+            if (x + 1 < n)
+                g.add_adjacency(y * n + x, y * n + x + 1);
+            if (y + 1 < n)
+                g.add_adjacency(y * n + x, (y + 1) * n + x);
+        }
+    return g;
+}
+
+void bench_generation(bench_runner &b) {
+    random_gen numbers(1);
+    b.run("random_gen::get",
+          [&] { sink = sink + size_t(numbers.get(sig(0), sig(99))); });
+    array<uint64_t, 1024> block;
+    b.run("random_gen::fill/1024", [&] {
+        numbers.fill(block.data(), block.size());
+        sink = sink + size_t(block[0]);
+    });
+    for (sig size : {24, 64, 256}) {
+        auto n = "/" + to_string(size);
+        random_gen rand(1);
+        b.run("random_grid" + n, [&] {
+            sink = sink + size_t(random_grid(rand, size).size());
+        });
+        b.run("noise_terrain_grid" + n, [&] {
+            sink = sink + size_t(noise_terrain_grid(rand, size).size());
+        });
+        b.run("build_room" + n, [&] {
+            sink = sink + build_room(rand, size).second.size();
+        });
+        b.run("build_room/noise" + n, [&] {
+            sink = sink + build_room(rand, size, noise_terrain_grid)
+                              .second.size();
+        });
+        auto built = build_room(rand, size).first;
+        auto scratch = reach_scratch();
+        b.run("reachable_cells" + n, [&] {
+            sink = sink +
+                   reachable_cells(built[0], size / 2, size / 2, scratch)[0];
+        });
+    }
+}
+
+void bench_simulation(bench_runner &b) {
+    for (sig size : {24, 64, 256})
+        for (sig count : {16, 256}) {
+            auto n = "/" + to_string(size) + "/" + to_string(count);
+            random_gen rand(1);
+            auto const room = floor_room(size);
+            auto player = specimen{.pos = {1, 1, size - 1, 0},
+                                   .life_points = 1 << 30};
+            auto random_cell = [&] {
+                return plane_coord(rand.get(sig(2), size - 3),
+                                   rand.get(sig(2), size - 3), size - 1, 0);
+            };
+
+            projectiles launched;
+            for (sig i = 0; i < count; i++) {
+                auto kind = i % 2 ? tile::idents::propelled_bomb
+                                  : tile::idents::propelled_dart;
+                auto vel = pair<sig, sig>{rand.get(sig(1), sig(2)),
+                                          rand.get(sig(-2), sig(2))};
+                launched.push(kind, random_cell(), vel,
+                              PROJECTILE_KINDS[size_t(kind)].energy);
+            }
+            auto grid = room;
+            auto objects = launched;
+            auto hazards = cell_map<active_hazard>(size);
+            auto field = flow_field(size);
+            auto timers = hazard_timers();
+            b.run(
+                "apply_movement" + n,
+                [&] {
+                    grid = room, objects = launched;
+                    hazards = cell_map<active_hazard>(size), timers = {};
+                },
+                [&] {
+                    apply_movement(grid, objects, hazards, field, player,
+                                   timers, 0);
+                    sink = sink + objects.size();
+                });
+
+            auto trapped = room;
+            auto traps = cell_map<active_hazard>(size);
+            auto due = vector<plane_coord>();
+            for (sig i = 0; i < count; i++) {
+                auto c = random_cell();
+                auto kind =
+                    i % 2 ? tile::idents::bomb_trap : tile::idents::dart_trap;
+                if (traps.count(c))
+                    continue;
+                trapped[0][c] = kind;
+                traps[c] = {&ALL_HAZARDS.at(kind)};
+                due.push_back(c);
+            }
+            player.pos = plane_coord(size / 2, 1, size - 1, 0);
+            auto distances = flow_field(size);
+            distances.retarget(player.pos);
+            distances.advance(trapped[0], size * size);
+            b.run(
+                "trigger_primed_hazards" + n, [&] { objects.resize(0); },
+                [&] {
+                    trigger_primed_hazards(due, traps, trapped, objects,
+                                           player, distances);
+                    sink = sink + objects.size();
+                });
+        }
+}
+
+void bench_graph(bench_runner &b) {
+    for (sig size : {24, 64, 256}) {
+        auto n = "/" + to_string(size);
+        auto g = grid_graph(size);
+        auto csr = csr_graph(g);
+        auto last = int(size * size - 1);
+        b.run("bfs::path" + n, [&] {
+            sink = sink + bfs(g).path(0, last)->size();
+        });
+        b.run("bfs::path/csr" + n, [&] {
+            sink = sink + bfs(csr).path(0, last)->size();
+        });
+        b.run("dfs::time" + n, [&] {
+            sink = sink + size_t(*dfs(g).time(0, last));
+        });
+        b.run("dfs::time/csr" + n, [&] {
+            sink = sink + size_t(*dfs(csr).time(0, last));
+        });
+        b.run("dijkstra::path/csr" + n, [&] {
+            sink = sink + dijkstra(csr).path(0, last)->size();
+        });
+
+        auto room = floor_room(size);
+        auto cells = cell_graph(room[0], passable_tiles(room[0]));
+        auto corner = cells.vertex(1, 1),
+             opposite = cells.vertex(size - 2, size - 2);
+        b.run("bfs::path/cells" + n, [&] {
+            sink = sink + bfs(cells).path(corner, opposite)->size();
+        });
+        b.run("dfs::time/cells" + n, [&] {
+            sink = sink + size_t(*dfs(cells).time(corner, opposite));
+        });
+
+        auto field = flow_field(size);
+        auto flip = false;
+        b.run(
+            "flow_field::sweep" + n,
+            [&] {
+                flip = !flip;
+                auto x = flip ? sig(1) : size - 2;
+                field.retarget(plane_coord(x, 1, size - 1, 0));
+            },
+            [&] {
+                field.advance(room[0], size * size);
+                sink = sink + size_t(field.distance(size / 2, size / 2));
+            });
+    }
+}
+
+void bench_render(bench_runner &b) {
+    if (!b.selected("print_grid"))
+        return;
+    setenv("SDL_VIDEODRIVER", "dummy", 1);
+    Init _init(SDL_INIT_VIDEO);
+    assert_true(TTF_Init() == 0, "TTF init failed");
+    Font font("NotoMono-Regular.ttf", 24);
+    for (sig size : {24, 64}) {
+        auto pixels = font.height() * int(size);
+        Window win(pixels, pixels, "microbench");
+        random_gen rand(1);
+        auto [room, door_coords] = build_room(rand, size);
+        auto doors = map<plane_coord, sig>();
+        for (auto &c : door_coords)
+            doors[c] = sig(doors.size());
+        auto rect = SDL_Rect{0, 0, int(size), int(size)};
+        print_grid(room, ALL_TILES, doors, win, rect, font); // fill the cache
+        b.run("print_grid/" + to_string(size), [&] {
+            auto area = print_grid(room, ALL_TILES, doors, win, rect, font);
+            sink = sink + size_t(area.w);
+        });
+    }
+}
+
+void write_json(ostream &o, vector<result> const &results) {
+    o << "{\"benchmarks\": [\n" << setprecision(3) << fixed;
+    for (auto i : nums(0_s, results.size())) {
+        auto &r = results[i];
+        o << "  {\"name\": \"" << r.name << "\", \"ops\": " << r.ops
+          << ", \"ns_per_op\": " << r.ns_per_op
+          << ", \"allocs_per_op\": " << r.allocs_per_op
+          << ", \"cache_misses_per_op\": ";
+        if (r.misses_per_op)
+            o << *r.misses_per_op;
+        else
+            o << "null";
+        o << (i + 1 < results.size() ? "},\n" : "}\n");
+    }
+    o << "]}\n";
+}
+
+/// Reads the ns/op of every benchmark in a file written by write_json().
+map<string, double> read_baseline(istream &in) {
+    map<string, double> r;
+    string line;
+    while (getline(in, line)) {
+        auto name = line.find("\"name\": \""),
+             ns = line.find("\"ns_per_op\": ");
+        if (name == string::npos || ns == string::npos)
+            continue;
+        name += 9;
+        r[line.substr(name, line.find('"', name) - name)] =
+            strtod(line.c_str() + ns + 13, nullptr);
+    }
+    return r;
+}
+
+int main(int argc, char **argv) {
+    auto filter = string();
+    auto out_path = optional<string>(), baseline_path = optional<string>();
+    auto tolerance = 10.0;
+    for (auto i = 1; i < argc; i++) {
+        auto has_value = i + 1 < argc;
+        if (!strcmp(argv[i], "--filter") && has_value)
+            filter = argv[++i];
+        else if (!strcmp(argv[i], "--out") && has_value)
+            out_path = argv[++i];
+        else if (!strcmp(argv[i], "--baseline") && has_value)
+            baseline_path = argv[++i];
+        else if (!strcmp(argv[i], "--tolerance") && has_value)
+            tolerance = strtod(argv[++i], nullptr);
+        else {
+            cerr << "usage: " << argv[0]
+                 << " [--filter TEXT] [--out FILE] [--baseline FILE]"
+                    " [--tolerance PERCENT]\n";
+            return 1;
+        }
+    }
+
+    bench_runner b(filter);
+    bench_generation(b);
+    bench_simulation(b);
+    bench_graph(b);
+    bench_render(b);
+
+    if (out_path) {
+        ofstream o(*out_path);
+        write_json(o, b.results);
+    }
+    if (!baseline_path)
+        return 0;
+    ifstream in(*baseline_path);
+    auto baseline = read_baseline(in);
+    auto regressions = 0;
+    for (auto &r : b.results) {
+        auto it = baseline.find(r.name);
+        if (it == baseline.end() || it->second <= 0)
+            continue;
+        auto change = (r.ns_per_op / it->second - 1) * 100;
+        if (change > tolerance) {
+            cout << "REGRESSION " << r.name << ": " << it->second << " -> "
+                 << r.ns_per_op << " ns/op (+" << change << "%)\n";
+            regressions++;
+        }
+    }
+    cout << regressions << " regression(s) against " << *baseline_path
+         << "\n";
+    return regressions ? 1 : 0;
+}
@@ -0,0 +1,329 @@
+#pragma once
+#include <_main.hpp>
+#include <cstring>
+#include "tile.hpp"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define NOISE_X86
+#endif
+
+/**
+ * Room terrain from coherent value noise: rubble and decorated floor come in
+ * patches and pillars in clusters, instead of being scattered cell by cell.
+ * Every tile only depends on the seed and its room coordinates, so any part
+ * of a room can be filled on its own.
+ *
+ * A row is filled in blocks, one pass at a time: hashing the lattice points
+ * the block needs, interpolating them out to every cell, and thresholding
+ * the fields into tiles. Each pass has an AVX2 or SSE4.1 path that is picked
+ * at run time, and a scalar one. The arithmetic is integer only, so all of
+ * them produce the same terrain.
+ */
+class noise_terrain {
+    /// lattice hash constants, and seed offsets of the separate fields
+    static constexpr uint32_t HASH_X = 0x8da6b343, HASH_Y = 0xd8163841,
+                              MIX_1 = 0x2c1b3c6d, MIX_2 = 0x297a2d39,
+                              DETAIL = 0x68e31da4, CLUSTER = 0xb5297a4d,
+                              SCATTER = 0x1b56c4e9;
+    /// thresholds on noise values in [0, 65536): quantiles of the measured
+    /// field distributions, so the tile shares match ROOM_TILE_WEIGHTS to
+    /// within a tenth of a percent
+    static constexpr int32_t PILLAR_ABOVE = 61600, RUBBLE_ABOVE = 40800,
+                             DECOR_BELOW = 19400, TRAP_BELOW = 1820,
+                             CRACK_BELOW = 20020;
+    /// cells per block, and lattice spacing (as shifts) of the fields
+    static constexpr size_t BLOCK = 256;
+    static constexpr int COARSE = 4, FINE = 2;
+    uint32_t seed_;
+
+    static uint32_t hash(uint32_t seed, int32_t ix, int32_t iy) {
+        auto h = uint32_t(ix) * HASH_X + uint32_t(iy) * HASH_Y + seed;
+        h ^= h >> 15, h *= MIX_1;
+        h ^= h >> 12, h *= MIX_2;
+        return h ^ h >> 15;
+    }
+    /// 3t^2 - 2t^3 for t in [0, 256), scaled to [0, 256)
+    static int32_t smooth(int32_t t) { return t * t * (768 - 2 * t) >> 16; }
+    static int32_t lerp(int32_t a, int32_t b, int32_t w) {
+        return a + ((b - a) * w >> 8);
+    }
+    /// Branch free, since the outcome is as good as random from cell to cell.
+    static tile::idents classify(int32_t patches, int32_t clusters,
+                                 int32_t scatter) {
+        auto t = scatter < CRACK_BELOW ? tile::idents::cracked_stone_flooring
+                                       : tile::idents::stone_flooring;
+        t = scatter < TRAP_BELOW ? scatter & 1 ? tile::idents::dart_trap
+                                               : tile::idents::bomb_trap
+                                 : t;
+        t = patches < DECOR_BELOW ? tile::idents::decorated_stone_flooring : t;
+        t = patches > RUBBLE_ABOVE ? tile::idents::stone_rubble_pile : t;
+        return clusters > PILLAR_ABOVE ? tile::idents::stone_pillar : t;
+    }
+
+#ifdef NOISE_X86
+    /**
+     * The vector paths. Each does the leading cells that fill whole vectors
+     * and returns how many that were; the scalar loop does the rest. They are
+     * compiled for their instruction set only, so the rest of the program
+     * runs on any x86 CPU.
+     */
+    struct cpu_features {
+        bool avx2, sse41;
+    };
+    static cpu_features const &cpu() {
+        static cpu_features const features{
+            __builtin_cpu_supports("avx2") != 0,
+            __builtin_cpu_supports("sse4.1") != 0};
+        return features;
+    }
+
+    __attribute__((target("avx2"))) static size_t
+    hash_run_avx2(uint32_t seed, int32_t ix0, int32_t iy, size_t n,
+                  int32_t *out) {
+        auto row = _mm256_set1_epi32(int(uint32_t(iy) * HASH_Y + seed));
+        auto ix = _mm256_add_epi32(_mm256_set1_epi32(ix0),
+                                   _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            auto h = _mm256_add_epi32(
+                _mm256_mullo_epi32(ix, _mm256_set1_epi32(int(HASH_X))), row);
+            h = _mm256_xor_si256(h, _mm256_srli_epi32(h, 15));
+            h = _mm256_mullo_epi32(h, _mm256_set1_epi32(int(MIX_1)));
+            h = _mm256_xor_si256(h, _mm256_srli_epi32(h, 12));
+            h = _mm256_mullo_epi32(h, _mm256_set1_epi32(int(MIX_2)));
+            h = _mm256_xor_si256(h, _mm256_srli_epi32(h, 15));
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i),
+                                _mm256_srli_epi32(h, 16));
+            ix = _mm256_add_epi32(ix, _mm256_set1_epi32(8));
+        }
+        return i;
+    }
+    __attribute__((target("sse4.1"))) static size_t
+    hash_run_sse41(uint32_t seed, int32_t ix0, int32_t iy, size_t n,
+                   int32_t *out) {
+        auto row = _mm_set1_epi32(int(uint32_t(iy) * HASH_Y + seed));
+        auto ix =
+            _mm_add_epi32(_mm_set1_epi32(ix0), _mm_setr_epi32(0, 1, 2, 3));
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            auto h = _mm_add_epi32(
+                _mm_mullo_epi32(ix, _mm_set1_epi32(int(HASH_X))), row);
+            h = _mm_xor_si128(h, _mm_srli_epi32(h, 15));
+            h = _mm_mullo_epi32(h, _mm_set1_epi32(int(MIX_1)));
+            h = _mm_xor_si128(h, _mm_srli_epi32(h, 12));
+            h = _mm_mullo_epi32(h, _mm_set1_epi32(int(MIX_2)));
+            h = _mm_xor_si128(h, _mm_srli_epi32(h, 15));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i),
+                             _mm_srli_epi32(h, 16));
+            ix = _mm_add_epi32(ix, _mm_set1_epi32(4));
+        }
+        return i;
+    }
+
+    /// Lattice cells are 4 or 16 cells wide, so one vector of weights covers
+    /// a lattice cell or a quarter of it; AVX2 would not gain anything here.
+    __attribute__((target("sse4.1"))) static size_t
+    spread_sse41(int32_t const *columns, size_t n, int shift,
+                 int32_t const *wx, int32_t *out) {
+        auto width = size_t(1) << shift;
+        for (size_t k = 0; k + 1 < n; k++) {
+            auto a = _mm_set1_epi32(columns[k]),
+                 d = _mm_set1_epi32(columns[k + 1] - columns[k]);
+            for (size_t j = 0; j < width; j += 4) {
+                auto w =
+                    _mm_loadu_si128(reinterpret_cast<__m128i const *>(wx + j));
+                _mm_storeu_si128(
+                    reinterpret_cast<__m128i *>(out + k * width + j),
+                    _mm_add_epi32(a,
+                                  _mm_srai_epi32(_mm_mullo_epi32(d, w), 8)));
+            }
+        }
+        return n - 1;
+    }
+
+    /// classify() on whole vectors; later blends take precedence, like
+    /// earlier conditions in classify().
+    __attribute__((target("avx2"))) static size_t
+    classify_avx2(int32_t const *coarse, int32_t const *detail,
+                  int32_t const *cluster, int32_t const *scatter, size_t n,
+                  tile::idents *out) {
+        auto id = [](tile::idents t) { return int(t); };
+        auto one = _mm256_set1_epi32(1);
+        /// the low byte of every lane, in order
+        auto bytes = _mm256_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1,
+                                      -1, -1, -1, -1, -1, 0, 4, 8, 12, -1, -1,
+                                      -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+        auto halves = _mm256_setr_epi32(0, 4, 0, 0, 0, 0, 0, 0);
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            auto patches = _mm256_srai_epi32(
+                _mm256_add_epi32(
+                    _mm256_mullo_epi32(
+                        _mm256_loadu_si256(
+                            reinterpret_cast<__m256i const *>(coarse + i)),
+                        _mm256_set1_epi32(3)),
+                    _mm256_loadu_si256(
+                        reinterpret_cast<__m256i const *>(detail + i))),
+                2);
+            auto clusters = _mm256_loadu_si256(
+                reinterpret_cast<__m256i const *>(cluster + i));
+            auto scattered = _mm256_loadu_si256(
+                reinterpret_cast<__m256i const *>(scatter + i));
+            auto trap = _mm256_blendv_epi8(
+                _mm256_set1_epi32(id(tile::idents::bomb_trap)),
+                _mm256_set1_epi32(id(tile::idents::dart_trap)),
+                _mm256_cmpeq_epi32(_mm256_and_si256(scattered, one), one));
+            auto t = _mm256_blendv_epi8(
+                _mm256_set1_epi32(id(tile::idents::stone_flooring)),
+                _mm256_set1_epi32(id(tile::idents::cracked_stone_flooring)),
+                _mm256_cmpgt_epi32(_mm256_set1_epi32(CRACK_BELOW), scattered));
+            t = _mm256_blendv_epi8(
+                t, trap,
+                _mm256_cmpgt_epi32(_mm256_set1_epi32(TRAP_BELOW), scattered));
+            t = _mm256_blendv_epi8(
+                t,
+                _mm256_set1_epi32(id(tile::idents::decorated_stone_flooring)),
+                _mm256_cmpgt_epi32(_mm256_set1_epi32(DECOR_BELOW), patches));
+            t = _mm256_blendv_epi8(
+                t, _mm256_set1_epi32(id(tile::idents::stone_rubble_pile)),
+                _mm256_cmpgt_epi32(patches, _mm256_set1_epi32(RUBBLE_ABOVE)));
+            t = _mm256_blendv_epi8(
+                t, _mm256_set1_epi32(id(tile::idents::stone_pillar)),
+                _mm256_cmpgt_epi32(clusters, _mm256_set1_epi32(PILLAR_ABOVE)));
+            t = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(t, bytes),
+                                            halves);
+            _mm_storel_epi64(reinterpret_cast<__m128i *>(out + i),
+                             _mm256_castsi256_si128(t));
+        }
+        return i;
+    }
+    __attribute__((target("sse4.1"))) static size_t
+    classify_sse41(int32_t const *coarse, int32_t const *detail,
+                   int32_t const *cluster, int32_t const *scatter, size_t n,
+                   tile::idents *out) {
+        auto id = [](tile::idents t) { return int(t); };
+        auto one = _mm_set1_epi32(1);
+        auto bytes = _mm_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1,
+                                   -1, -1, -1, -1);
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            auto patches = _mm_srai_epi32(
+                _mm_add_epi32(
+                    _mm_mullo_epi32(_mm_loadu_si128(
+                                        reinterpret_cast<__m128i const *>(
+                                            coarse + i)),
+                                    _mm_set1_epi32(3)),
+                    _mm_loadu_si128(
+                        reinterpret_cast<__m128i const *>(detail + i))),
+                2);
+            auto clusters =
+                _mm_loadu_si128(reinterpret_cast<__m128i const *>(cluster + i));
+            auto scattered =
+                _mm_loadu_si128(reinterpret_cast<__m128i const *>(scatter + i));
+            auto trap = _mm_blendv_epi8(
+                _mm_set1_epi32(id(tile::idents::bomb_trap)),
+                _mm_set1_epi32(id(tile::idents::dart_trap)),
+                _mm_cmpeq_epi32(_mm_and_si128(scattered, one), one));
+            auto t = _mm_blendv_epi8(
+                _mm_set1_epi32(id(tile::idents::stone_flooring)),
+                _mm_set1_epi32(id(tile::idents::cracked_stone_flooring)),
+                _mm_cmplt_epi32(scattered, _mm_set1_epi32(CRACK_BELOW)));
+            t = _mm_blendv_epi8(
+                t, trap,
+                _mm_cmplt_epi32(scattered, _mm_set1_epi32(TRAP_BELOW)));
+            t = _mm_blendv_epi8(
+                t, _mm_set1_epi32(id(tile::idents::decorated_stone_flooring)),
+                _mm_cmplt_epi32(patches, _mm_set1_epi32(DECOR_BELOW)));
+            t = _mm_blendv_epi8(
+                t, _mm_set1_epi32(id(tile::idents::stone_rubble_pile)),
+                _mm_cmpgt_epi32(patches, _mm_set1_epi32(RUBBLE_ABOVE)));
+            t = _mm_blendv_epi8(
+                t, _mm_set1_epi32(id(tile::idents::stone_pillar)),
+                _mm_cmpgt_epi32(clusters, _mm_set1_epi32(PILLAR_ABOVE)));
+            auto packed = _mm_cvtsi128_si32(_mm_shuffle_epi8(t, bytes));
+            memcpy(out + i, &packed, 4);
+        }
+        return i;
+    }
+#endif
+
+    /// The upper 16 bits of hash(seed, ix0 + i, iy) for i in [0, n).
+    static void hash_run(uint32_t seed, int32_t ix0, int32_t iy, size_t n,
+                         int32_t *out) {
+        size_t i = 0;
+#ifdef NOISE_X86
+        if (cpu().avx2)
+            i = hash_run_avx2(seed, ix0, iy, n, out);
+        else if (cpu().sse41)
+            i = hash_run_sse41(seed, ix0, iy, n, out);
+#endif
+        for (; i < n; i++)
+            out[i] = int32_t(hash(seed, ix0 + int32_t(i), iy) >> 16);
+    }
+
+    /**
+     * One field of value noise on a lattice of 2^shift cells, along row y,
+     * over the n - 1 lattice cells from column ix0. The values at the lattice
+     * columns are interpolated between the lattice rows above and below y,
+     * then between the columns for every cell.
+     */
+    static void field(uint32_t seed, int32_t ix0, int32_t y, int shift,
+                      size_t n, int32_t *out) {
+        array<int32_t, BLOCK + 2> above, below;
+        auto width = size_t(1) << shift;
+        hash_run(seed, ix0, y >> shift, n, above.data());
+        hash_run(seed, ix0, (y >> shift) + 1, n, below.data());
+        auto wy = smooth((y & int32_t(width - 1)) << (8 - shift));
+        for (size_t k = 0; k < n; k++)
+            above[k] = lerp(above[k], below[k], wy);
+        array<int32_t, size_t(1) << COARSE> wx;
+        for (size_t j = 0; j < width; j++)
+            wx[j] = smooth(int32_t(j) << (8 - shift));
+
+        size_t k = 0;
+#ifdef NOISE_X86
+        if (cpu().sse41)
+            k = spread_sse41(above.data(), n, shift, wx.data(), out);
+#endif
+        for (; k + 1 < n; k++)
+            for (size_t j = 0; j < width; j++)
+                out[k * width + j] = lerp(above[k], above[k + 1], wx[j]);
+    }
+
+    void fill_block(int32_t x0, int32_t y, size_t n, tile::idents *out) const {
+        array<int32_t, BLOCK + (1 << COARSE)> coarse, detail, cluster;
+        array<int32_t, BLOCK> scatter;
+        auto x1 = x0 + int32_t(n) - 1;
+        auto cx = x0 >> COARSE, fx = x0 >> FINE;
+        field(seed_, cx, y, COARSE, size_t((x1 >> COARSE) - cx + 2),
+              coarse.data());
+        field(seed_ ^ DETAIL, fx, y, FINE, size_t((x1 >> FINE) - fx + 2),
+              detail.data());
+        field(seed_ ^ CLUSTER, fx, y, FINE, size_t((x1 >> FINE) - fx + 2),
+              cluster.data());
+        hash_run(seed_ ^ SCATTER, x0, y, n, scatter.data());
+
+        /// the fields start at the lattice column at or left of x0
+        auto c = coarse.data() + (x0 - (cx << COARSE)),
+             d = detail.data() + (x0 - (fx << FINE)),
+             k = cluster.data() + (x0 - (fx << FINE));
+        size_t i = 0;
+#ifdef NOISE_X86
+        if (cpu().avx2)
+            i = classify_avx2(c, d, k, scatter.data(), n, out);
+        else if (cpu().sse41)
+            i = classify_sse41(c, d, k, scatter.data(), n, out);
+#endif
+        for (; i < n; i++)
+            out[i] = classify((3 * c[i] + d[i]) >> 2, k[i], scatter[i]);
+    }
+
+  public:
+    explicit noise_terrain(uint32_t seed) : seed_(seed) {}
+
+    /// Writes the tiles of the cells [x0, x0 + n) of row y to `out`.
+    void fill_row(int32_t x0, int32_t y, size_t n, tile::idents *out) const {
+        for (size_t i = 0; i < n; i += BLOCK)
+            fill_block(x0 + int32_t(i), y, min(BLOCK, n - i), out + i);
+    }
+};
@@ -0,0 +1,159 @@
+#pragma once
+#include <_main.hpp>
+#include <sdl_wrap.hpp>
+#include "coord.hpp"
+#include "grid.hpp"
+#include "tile.hpp"
+
+optional<plane_coord> find_adjoining_tile(grid const &grid,
+                                          plane_coord const &coord,
+                                          tile::idents tile) {
+    static constexpr pair<sig, sig> offsets[] = {
+        {-1, -1}, {0, -1}, {1, -1}, {-1, 0}, {1, 0}, {-1, 1}, {0, 1}, {1, 1}};
+    sig x = coord.x(), y = coord.y();
+    for (auto &[dx, dy] : offsets)
+        if (static_cast<tile::idents>(grid[{x + dx, y + dy}]) == tile)
+            return {{x + dx, y + dy, grid.size() - 1, 0}};
+    return {};
+}
+
+optional<char> get_tile_symbol(grid const &grid,
+                               tile_table const &tiles,
+                               map<plane_coord, sig> const &doors,
+                               plane_coord const &coord) {
+    if (!tile_satisfies_flags(grid, coord, tile::flag_bits::shape_changing))
+        return tiles[grid[coord]].symbol;
+    switch (grid[coord]) {
+    case tile::idents::doorway_sigil: {
+        auto door_coord =
+            *find_adjoining_tile(grid, coord, tile::idents::doorway);
+        auto door_num = distance(begin(doors), doors.find(door_coord));
+        return 'A' + door_num;
+    }
+    default:
+        return {};
+    };
+}
+
+/// Draws the topmost non-empty layer at (x,y), or a blank cell.
+SDL_Rect print_cell(layers const &layers, tile_table const &tiles,
+                    map<plane_coord, sig> const &doors, Window const &win,
+                    SDL_Rect const &rect, Font const &font, sig x, sig y) {
+    auto win_x = rect.x + int(x), win_y = rect.y + int(y);
+    for (auto grid = layers.rbegin(); grid != layers.rend(); ++grid) {
+        auto ident = grid->cell(x, y);
+        if (ident == tile::idents::nil)
+            continue;
+        if (!tiles.contains(ident))
+            return font.renderGlyph('?', color_idents::WHITE_ON_BLACK, win,
+                                    win_x, win_y);
+        auto c = plane_coord(x, y, grid->size() - 1, 0);
+        return font.renderGlyph(*get_tile_symbol(*grid, tiles, doors, c),
+                                tiles[ident].color, win, win_x, win_y);
+    }
+    return font.renderGlyph(' ', color_idents::WHITE_ON_BLACK, win, win_x,
+                            win_y);
+}
+
+/// Returns the pixel area covered by the room.
+SDL_Rect print_grid(layers const &layers, tile_table const &tiles,
+                    map<plane_coord, sig> const &doors, Window const &win,
+                    SDL_Rect const &rect, Font const &font) {
+    auto size = layers.at(0).size();
+    SDL_Rect first{}, last{};
+    for (sig y = 0; y < size; y++)
+        for (sig x = 0; x < size; x++) {
+            last = print_cell(layers, tiles, doors, win, rect, font, x, y);
+            if (x == 0 && y == 0)
+                first = last;
+        }
+    return {first.x, first.y, last.x + last.w - first.x,
+            last.y + last.h - first.y};
+}
+
+/**
+ * Redraws the cells that changed since the last call and appends the pixel
+ * areas that need to be copied to the screen to `updated`.
+ */
+void print_dirty_cells(layers &layers, tile_table const &tiles,
+                       map<plane_coord, sig> const &doors, Window const &win,
+                       SDL_Rect const &rect, Font const &font,
+                       vector<SDL_Rect> &updated) {
+    if (any_of(begin(layers), end(layers),
+               [](auto &grid) { return grid.all_dirty(); }))
+        updated.push_back(print_grid(layers, tiles, doors, win, rect, font));
+    else
+        for (auto &grid : layers)
+            for (auto &[x, y] : grid.dirty_cells())
+                updated.push_back(
+                    print_cell(layers, tiles, doors, win, rect, font, x, y));
+    for (auto &grid : layers)
+        grid.clear_dirty();
+}
+
+/// The part of a room that is shown in a view of w x h cells.
+struct camera {
+    sig x = 0, y = 0; // room cell in the top left corner of the view
+    sig w, h;
+
+    bool contains(sig cx, sig cy) const {
+        return cx >= x && cy >= y && cx < x + w && cy < y + h;
+    }
+    /**
+     * Scrolls just far enough to keep (tx,ty) `margin` cells away from the
+     * edges of the view, without going past a room of `room_size` cells.
+     * Returns whether the camera moved.
+     */
+    bool follow(sig tx, sig ty, sig margin, sig room_size) {
+        auto scroll = [&](sig pos, sig t, sig len) {
+            pos = max(min(pos, t - margin), t + margin - len + 1);
+            return max(min(pos, room_size - len), sig(0));
+        };
+        auto new_x = scroll(x, tx, w), new_y = scroll(y, ty, h);
+        auto moved = new_x != x || new_y != y;
+        x = new_x, y = new_y;
+        return moved;
+    }
+};
+
+/**
+ * Draws the cells of a chunk of a larger room, whose top left cell is
+ * (x0,y0), that are inside the camera's view: all of them if `redraw` is set
+ * or the chunk is all dirty, otherwise the ones that changed. Appends the
+ * pixel areas to `updated`.
+ */
+void print_chunk_cells(layers &layers, sig x0, sig y0, camera const &view,
+                       tile_table const &tiles, Window const &win,
+                       SDL_Rect const &rect, Font const &font, bool redraw,
+                       vector<SDL_Rect> &updated) {
+    static map<plane_coord, sig> const no_doors;
+    auto shifted = SDL_Rect{rect.x + int(x0 - view.x),
+                            rect.y + int(y0 - view.y), rect.w, rect.h};
+    auto size = layers.at(0).size();
+    if (redraw || any_of(begin(layers), end(layers),
+                         [](auto &grid) { return grid.all_dirty(); })) {
+        auto first_x = max(view.x - x0, sig(0)),
+             first_y = max(view.y - y0, sig(0)),
+             last_x = min(view.x + view.w - x0, size) - 1,
+             last_y = min(view.y + view.h - y0, size) - 1;
+        auto first = optional<SDL_Rect>();
+        for (auto y = first_y; y <= last_y; y++)
+            for (auto x = first_x; x <= last_x; x++) {
+                auto r = print_cell(layers, tiles, no_doors, win, shifted,
+                                    font, x, y);
+                if (!first)
+                    first = r;
+            }
+        if (first)
+            updated.push_back({first->x, first->y,
+                               int(last_x - first_x + 1) * first->w,
+                               int(last_y - first_y + 1) * first->h});
+    } else
+        for (auto &grid : layers)
+            for (auto &[x, y] : grid.dirty_cells())
+                if (view.contains(x0 + x, y0 + y))
+                    updated.push_back(print_cell(layers, tiles, no_doors, win,
+                                                 shifted, font, x, y));
+    for (auto &grid : layers)
+        grid.clear_dirty();
+}
@@ -0,0 +1,94 @@
+#pragma once
+#include <_main.hpp>
+#include "builder.hpp"
+
+/**
+ * Worker pool that generates rooms in the background.
+ * Rooms are built with generate_room(), so a room taken from the pool is
+ * identical to one built on the calling thread.
+ */
+class room_pool {
+    random_device::result_type seed_;
+    int window_size_;
+    mutex m_;
+    condition_variable ready_, pending_;
+    deque<sig> queue_;
+    /// Requested rooms; empty while the room is queued or being built.
+    map<sig, optional<built_room>> rooms_;
+    bool stopping_ = false;
+    vector<thread> workers_;
+
+    void work() {
+        auto lock = unique_lock(m_);
+        while (true) {
+            pending_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+            if (stopping_)
+                return;
+            auto id = queue_.front();
+            queue_.pop_front();
+            lock.unlock();
+            auto room = generate_room(seed_, id, window_size_);
+            lock.lock();
+            // the request may have been withdrawn in the meantime
+            if (auto it = rooms_.find(id); it != rooms_.end()) {
+                it->second = move(room);
+                ready_.notify_all();
+            }
+        }
+    }
+
+  public:
+    room_pool(random_device::result_type seed, int window_size,
+              unsigned threads = max(2u, thread::hardware_concurrency()) - 1)
+        : seed_(seed), window_size_(window_size) {
+        generate_n(back_inserter(workers_), threads,
+                   [this] { return thread([this] { work(); }); });
+    }
+    ~room_pool() {
+        {
+            auto lock = unique_lock(m_);
+            stopping_ = true;
+        }
+        pending_.notify_all();
+        for (auto &w : workers_)
+            w.join();
+    }
+    room_pool(room_pool const &) = delete;
+    room_pool &operator=(room_pool const &) = delete;
+
+    /// Queues the given rooms and withdraws every other pending request.
+    void prefetch(vector<sig> const &ids) {
+        auto lock = unique_lock(m_);
+        for (auto it = begin(rooms_); it != end(rooms_);)
+            if (find(begin(ids), end(ids), it->first) == end(ids))
+                it = rooms_.erase(it);
+            else
+                ++it;
+        queue_.erase(remove_if(begin(queue_), end(queue_),
+                               [this](sig id) { return !rooms_.count(id); }),
+                     end(queue_));
+        for (auto id : ids)
+            if (rooms_.emplace(id, nullopt).second)
+                queue_.push_back(id);
+        pending_.notify_all();
+    }
+
+    /// Returns the room, waiting for it or building it here if necessary.
+    built_room take(sig id) {
+        auto lock = unique_lock(m_);
+        auto it = rooms_.find(id);
+        auto queued = find(begin(queue_), end(queue_), id);
+        if (it == end(rooms_) || queued != end(queue_)) {
+            if (queued != end(queue_))
+                queue_.erase(queued);
+            if (it != end(rooms_))
+                rooms_.erase(it);
+            lock.unlock();
+            return generate_room(seed_, id, window_size_);
+        }
+        ready_.wait(lock, [&it] { return it->second.has_value(); });
+        auto room = move(*it->second);
+        rooms_.erase(it);
+        return room;
+    }
+};
@@ -0,0 +1,117 @@
+/**
+ * Headless room generator: builds rooms exactly like the game does, without
+ * SDL, and reports the generation throughput.
+ *
+ * Usage: roomgen [seed] [count] [--window N] [--noise] [--text FILE]
+ *                [--binary FILE]
+ *
+ * Builds rooms 0..count-1 of a game started with `seed`. With --noise, the
+ * rooms get noise terrain instead, like the chunks of a large room. Rooms
+ * that fail the connectivity check are rebuilt; the share of rejected
+ * attempts is reported. The binary dump stores, per room: the room id
+ * (u64), the edge length and the layer count (i64 each), then every layer
+ * as row-major tile idents (one byte per cell).
+ */
+#include <_main.hpp>
+#include <alloc_count.hpp>
+#include <cstdlib>
+#include <cstring>
+
+#include "builder.hpp"
+#include "grid.hpp"
+#include "tile.hpp"
+
+void write_text(ostream &o, nat id, layers const &room,
+                vector<plane_coord> const &doors) {
+    auto size = room.at(0).size();
+    o << "room " << id << " " << size << "\n";
+    for (sig y = 0; y < size; y++) {
+        for (sig x = 0; x < size; x++) {
+            auto symbol = ' ';
+            for (auto grid = room.rbegin(); grid != room.rend(); ++grid)
+                if (auto ident = grid->cell(x, y); ident != tile::idents::nil) {
+                    symbol = ALL_TILES[ident].symbol;
+                    break;
+                }
+            o << symbol;
+        }
+        o << "\n";
+    }
+    o << "doors";
+    for (auto &d : doors)
+        o << " " << d;
+    o << "\n\n";
+}
+
+void write_binary(ostream &o, nat id, layers const &room) {
+    auto put = [&o](auto x) {
+        o.write(reinterpret_cast<char const *>(&x), sizeof(x));
+    };
+    put(uint64_t(id));
+    put(int64_t(room.at(0).size()));
+    put(int64_t(room.size()));
+    for (auto &grid : room)
+        for (sig y = 0; y < grid.size(); y++) {
+            auto row = grid.row(y);
+            o.write(reinterpret_cast<char const *>(row.data()),
+                    static_cast<streamsize>(row.size()));
+        }
+}
+
+int main(int argc, char **argv) {
+    auto seed = nat(0);
+    auto count = sig(1000);
+    auto window_size = 60;
+    auto terrain = terrain_generator(scattered_terrain);
+    ofstream text_out, binary_out;
+    auto positional = 0;
+    for (auto i = 1; i < argc; i++) {
+        auto has_value = i + 1 < argc;
+        if (!strcmp(argv[i], "--window") && has_value)
+            window_size = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--noise"))
+            terrain = noise_terrain_grid;
+        else if (!strcmp(argv[i], "--text") && has_value)
+            text_out.open(argv[++i]);
+        else if (!strcmp(argv[i], "--binary") && has_value)
+            binary_out.open(argv[++i], ios::binary);
+        else if (argv[i][0] != '-' && positional == 0)
+            seed = strtoull(argv[i], nullptr, 10), positional++;
+        else if (argv[i][0] != '-' && positional == 1)
+            count = strtoll(argv[i], nullptr, 10), positional++;
+        else {
+            cerr << "usage: " << argv[0]
+                 << " [seed] [count] [--window N] [--noise]"
+                    " [--text FILE] [--binary FILE]\n";
+            return 1;
+        }
+    }
+
+    auto cells = sig(0);
+    auto allocations = nat(0);
+    auto elapsed = chrono::steady_clock::duration::zero();
+    for (sig i = 0; i < count; i++) {
+        auto allocations_before = allocation_count.load();
+        auto start = chrono::steady_clock::now();
+        auto rand = random_gen(seed).split(nat(i));
+        auto size = random_room_size(rand, window_size);
+        auto &&[room, doors] = build_room(rand, size, terrain);
+        elapsed += chrono::steady_clock::now() - start;
+        allocations += allocation_count.load() - allocations_before;
+        cells += size * size;
+
+        if (text_out.is_open())
+            write_text(text_out, nat(i), room, doors);
+        if (binary_out.is_open())
+            write_binary(binary_out, nat(i), room);
+    }
+
+    auto seconds = chrono::duration<double>(elapsed).count();
+    cout << "rooms:            " << count << " (seed " << seed << ")\n"
+         << "rooms/sec:        " << double(count) / seconds << "\n"
+         << "cells/sec:        " << double(cells) / seconds << "\n"
+         << "allocations/room: " << double(allocations) / double(count)
+         << "\n"
+         << "rejected:         " << room_generation.rejected << " ("
+         << 100 * room_generation.rejection_rate() << "% of attempts)\n";
+}
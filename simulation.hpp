@@ -0,0 +1,384 @@
+#pragma once
+#include <_main.hpp>
+#include "cell_map.hpp"
+#include "coord.hpp"
+#include "flow_field.hpp"
+#include "grid.hpp"
+#include "tile.hpp"
+
+/// Simulation rate, independent of the frame rate and of input
+sig const TICKS_PER_SECOND = 24;
+/// Cells of the flow field sweep per tick; a 64x64 room takes 4 ticks
+sig const FLOW_FIELD_CELLS_PER_TICK = 1024;
+
+struct hazard {
+    enum class idents {
+        dart_trap,
+    };
+    struct behavior_bits {
+        static sig const none = 0b1, sling = 0b10, dissipate = 0b100,
+                         lob = 0b1000, blast = 1 << 4;
+    };
+    sig behavior;
+    chrono::milliseconds activation_time; // negative: never activates
+
+    optional<sig> damage;
+    optional<sig> energy;
+    vector<tile::idents> employed_tiles;
+};
+
+map<tile::idents, hazard> ALL_HAZARDS = {
+    {tile::idents::dart_trap,
+     {
+         .behavior = hazard::behavior_bits::sling,
+         .activation_time = 3s,
+         .employed_tiles = {tile::idents::propelled_dart},
+     }},
+    {tile::idents::bomb_trap,
+     {
+         .behavior = hazard::behavior_bits::lob,
+         .activation_time = 4s,
+         .employed_tiles = {tile::idents::propelled_bomb},
+     }},
+    {tile::idents::propelled_dart,
+     {
+         .behavior = hazard::behavior_bits::none,
+         .activation_time = -1s,
+         .damage = 5,
+         .energy = 10,
+         .employed_tiles = {},
+     }},
+    {tile::idents::propelled_bomb,
+     {
+         .behavior =
+             hazard::behavior_bits::none | hazard::behavior_bits::dissipate,
+         .activation_time = 3s,
+         .damage = 3,
+         .energy = 4,
+         .employed_tiles = {tile::idents::blazing_fire},
+     }},
+    {tile::idents::blazing_fire,
+     {
+         .behavior = hazard::behavior_bits::blast,
+         .activation_time = -1s,
+         .damage = 20,
+         .energy = 3,
+         .employed_tiles = {tile::idents::burned_rubble_pile},
+     }},
+};
+
+/// A hazard on a room: its kind's properties, shared through ALL_HAZARDS so
+/// that placing one copies nothing else, and its own next activation.
+struct active_hazard {
+    hazard const *props = nullptr;
+    sig next_activation = -1; // simulation tick
+};
+
+sig to_ticks(chrono::milliseconds d) {
+    return sig(d.count()) * TICKS_PER_SECOND / 1000;
+}
+
+/**
+ * Activation deadlines of a room's hazards as a min-heap, in simulation
+ * ticks. A deadline only counts if the hazard at its position still expects
+ * it (see active_hazard::next_activation); anything else was cancelled and is
+ * dropped when it comes up.
+ */
+class hazard_timers {
+    using timer = pair<sig, plane_coord>;
+    priority_queue<timer, vector<timer>, greater<timer>> queue_;
+
+  public:
+    void schedule(cell_map<active_hazard> &active_hazards,
+                  plane_coord const &pos, sig deadline) {
+        active_hazards.at(pos).next_activation = deadline;
+        queue_.push({deadline, pos});
+    }
+    /// Replaces `due` by the hazards due at tick `now`, in deadline order.
+    void pop_due(cell_map<active_hazard> const &active_hazards, sig now,
+                 vector<plane_coord> &due) {
+        due.clear();
+        while (!queue_.empty() && queue_.top().first <= now) {
+            auto [deadline, pos] = queue_.top();
+            queue_.pop();
+            // a deadline scheduled twice comes up twice in a row
+            if (auto *h = active_hazards.find(pos);
+                h && h->next_activation == deadline &&
+                (due.empty() || due.back() != pos))
+                due.push_back(pos);
+        }
+    }
+    size_t size() const { return queue_.size(); }
+};
+
+/// Properties of a projectile kind, resolved once from ALL_HAZARDS.
+struct projectile_kind {
+    sig behavior = hazard::behavior_bits::none;
+    sig damage = 0;
+    sig energy = 0;
+    tile::idents residue = tile::idents::nil;
+};
+
+array<projectile_kind, tile::ident_count> const PROJECTILE_KINDS = [] {
+    array<projectile_kind, tile::ident_count> r{};
+    for (auto &[t, h] : ALL_HAZARDS)
+        r[size_t(t)] = {h.behavior, h.damage.value_or(0), h.energy.value_or(0),
+                        h.employed_tiles.empty() ? tile::idents::nil
+                                                 : h.employed_tiles[0]};
+    return r;
+}();
+
+/// The moving objects of a room, stored as structure of arrays.
+struct projectiles {
+    vector<int32_t> x, y;
+    vector<int8_t> vx, vy;
+    vector<int32_t> energy;
+    vector<tile::idents> kind;
+
+    size_t size() const { return kind.size(); }
+    bool empty() const { return kind.empty(); }
+    void push(tile::idents k, sig px, sig py, pair<sig, sig> vel, sig e) {
+        x.push_back(int32_t(px)), y.push_back(int32_t(py));
+        vx.push_back(int8_t(vel.first)), vy.push_back(int8_t(vel.second));
+        energy.push_back(int32_t(e));
+        kind.push_back(k);
+    }
+    void push(tile::idents k, plane_coord const &pos, pair<sig, sig> vel,
+              sig e) {
+        push(k, pos.x(), pos.y(), vel, e);
+    }
+    void resize(size_t n) {
+        x.resize(n), y.resize(n), vx.resize(n), vy.resize(n);
+        energy.resize(n), kind.resize(n);
+    }
+    size_t capacity_bytes() const {
+        return x.capacity() * 2 * sizeof(int32_t) +
+               vx.capacity() * 2 * sizeof(int8_t) +
+               energy.capacity() * sizeof(int32_t) +
+               kind.capacity() * sizeof(tile::idents);
+    }
+};
+
+struct specimen {
+    struct status_bits {
+        static sig const normal = 0b0, dead = 0b1;
+        status_bits() = delete;
+    };
+    sig status = status_bits::normal;
+    plane_coord pos;
+    sig life_points;
+};
+
+/**
+ * The cells of a single room as move_objects() sees them: the terrain, the
+ * projectile layer, and the hazards and flow field that follow the terrain.
+ */
+struct room_cells {
+    layers &grid;
+    cell_map<active_hazard> &active_hazards;
+    flow_field &distances;
+    hazard_timers &timers;
+    sig now;
+
+    sig size() const { return grid[0].size(); }
+    bool passable(sig x, sig y) const {
+        return grid[0].has_flags(x, y, tile::flag_bits::passable);
+    }
+    void show(sig x, sig y, tile::idents t) { grid[2].at(x, y) = t; }
+    void blast(sig x, sig y, tile::idents residue) {
+        grid[0].at(x, y) = residue;
+        distances.open(grid[0], {0, 0}, x, y);
+        // if a hazard is blasted, it is destroyed
+        active_hazards.erase(plane_coord(x, y, size() - 1, 0));
+    }
+    /// produce a hazardous effect on dissipation
+    void dissipate(sig x, sig y, tile::idents kind) {
+        auto pos = plane_coord(x, y, size() - 1, 0);
+        auto &props = ALL_HAZARDS.at(kind);
+        active_hazards[pos] = {&props};
+        timers.schedule(active_hazards, pos,
+                        now + to_ticks(props.activation_time));
+    }
+};
+
+/**
+ * Advances every object by one tick over `cells` (a room_cells, or the
+ * chunks of a chunked_room). Objects that ran out of energy or reached the
+ * room's border are dropped in the same pass.
+ * Returns whether a blast changed the terrain.
+ */
+template <class Cells>
+bool move_objects(Cells &cells, projectiles &objects, specimen &player) {
+    auto const max_xy = int32_t(cells.size() - 1);
+    auto const player_x = int32_t(player.pos.x()),
+               player_y = int32_t(player.pos.y());
+    size_t kept = 0;
+    auto blasted = false;
+    for (size_t i = 0; i < objects.size(); i++) {
+        auto x = objects.x[i], y = objects.y[i], energy = objects.energy[i];
+        auto kind = objects.kind[i];
+        auto &props = PROJECTILE_KINDS[size_t(kind)];
+        auto dx = objects.vx[i] > 0 ? 1 : objects.vx[i] < 0 ? -1 : 0,
+             dy = objects.vy[i] > 0 ? 1 : objects.vy[i] < 0 ? -1 : 0;
+        auto v_x = abs(objects.vx[i]), v_y = abs(objects.vy[i]);
+        cells.show(x, y, tile::idents::nil);
+        while ((v_x > 0 || v_y > 0) && energy > 0) {
+            energy--;
+            if (v_x > 0)
+                x = clamp(x + dx, 0, max_xy), v_x--;
+            if (v_y > 0)
+                y = clamp(y + dy, 0, max_xy), v_y--;
+
+            if (x == player_x && y == player_y) {
+                player.life_points -= props.damage;
+                energy = 0;
+            }
+            if (!cells.passable(x, y)) {
+                if (props.behavior & hazard::behavior_bits::blast) {
+                    cells.blast(x, y, props.residue);
+                    blasted = true;
+                }
+                energy = 0;
+            }
+        }
+        cells.show(x, y, kind);
+        if (energy <= 0) {
+            if (props.behavior & hazard::behavior_bits::dissipate)
+                cells.dissipate(x, y, kind);
+            else
+                cells.show(x, y, tile::idents::nil);
+            continue;
+        }
+        if (x == 0 || y == 0 || x == max_xy || y == max_xy) {
+            cells.show(x, y, tile::idents::nil);
+            continue;
+        }
+        objects.x[kept] = x, objects.y[kept] = y;
+        objects.vx[kept] = objects.vx[i], objects.vy[kept] = objects.vy[i];
+        objects.energy[kept] = energy, objects.kind[kept] = kind;
+        kept++;
+    }
+    objects.resize(kept);
+    return blasted;
+}
+
+/// move_objects() over a single room.
+bool apply_movement(layers &grid, projectiles &objects,
+                    cell_map<active_hazard> &active_hazards,
+                    flow_field &distances, specimen &player,
+                    hazard_timers &timers, sig now) {
+    auto cells = room_cells{grid, active_hazards, distances, timers, now};
+    return move_objects(cells, objects, player);
+}
+
+/**
+ * Fires the given hazards of `grid`. The objects, the player and the field
+ * are in room coordinates, which differ from those of the grid when it is a
+ * chunk: `origin` is the room cell of the grid's (0,0).
+ */
+void trigger_primed_hazards(cell_span<plane_coord const> due,
+                            cell_map<active_hazard> const &active_hazards,
+                            layers &grid, projectiles &moving_objects,
+                            specimen const &player,
+                            flow_field const &distances,
+                            pair<sig, sig> origin = {0, 0}) {
+    for (auto &c : due) {
+        auto &a = *active_hazards.at(c).props;
+        auto x = sig(c.x()) + origin.first, y = sig(c.y()) + origin.second;
+        if (a.behavior &
+            (hazard::behavior_bits::sling | hazard::behavior_bits::lob)) {
+            // pair<sig, sig> vel = {rand.get(-1, 1), rand.get(-1, 1)};
+            /// aim along the shortest way to the player; before the flow
+            /// field is ready, aim straight at them
+            auto vel = distances.next_step(x, y);
+            if (!vel) {
+                auto v_x = sig(player.pos.x()) - x,
+                     v_y = sig(player.pos.y()) - y,
+                     v_max = max(abs(v_x), abs(v_y));
+                vel = {v_x / v_max, v_y / v_max};
+            }
+            auto energy = PROJECTILE_KINDS[size_t(a.employed_tiles[0])].energy;
+            if ((vel->first | vel->second) == 0) // misfire
+                continue;
+            moving_objects.push(a.employed_tiles[0], x, y, *vel, energy);
+        }
+        if (a.behavior & hazard::behavior_bits::dissipate) {
+            grid[2][c] = tile::idents::nil;
+            auto energy = PROJECTILE_KINDS[size_t(a.employed_tiles[0])].energy;
+            static constexpr pair<sig, sig> vels[] = {
+                {0, -2}, {1, -1}, {2, 0},  {1, 1},
+                {0, 2},  {-1, 1}, {-2, 0}, {-1, -1}};
+            for (auto &vel : vels)
+                moving_objects.push(a.employed_tiles[0], x, y, vel, energy);
+        }
+    }
+}
+
+/// Everything that changes while the player is inside a room.
+struct room_state {
+    random_gen rand;
+    layers room;
+    cell_map<active_hazard> active_hazards;
+    projectiles moving_objects;
+    hazard_timers timers;
+    flow_field distances; // from the player
+    sig tick = 0; // simulation time spent in the room
+};
+
+room_state make_room_state(random_gen rand, layers room) {
+    auto const &terrain = room[0]; // reading must not mark cells dirty
+    auto active_hazards = cell_map<active_hazard>(terrain.size());
+    auto timers = hazard_timers();
+    for (auto &c : terrain) {
+        if (ALL_HAZARDS.count(terrain[c])) {
+            auto &props = ALL_HAZARDS.at(terrain[c]);
+            active_hazards[c] = {&props};
+            auto period = props.activation_time;
+            auto phase = period / rand.get(1, 4);
+            if (period > 0s)
+                timers.schedule(active_hazards, c, to_ticks(period - phase));
+        }
+    }
+    auto distances = flow_field(room[0].size());
+    return {move(rand),   move(room),     move(active_hazards), {},
+            move(timers), move(distances)};
+}
+
+/// Fires the hazards that are due at the room's current tick and sets
+/// their next activation. `due` is scratch space. The room may be a chunk
+/// at `origin` of a larger room, whose objects and field it shares (see
+/// trigger_primed_hazards).
+void fire_due_hazards(room_state &state, specimen const &player,
+                      vector<plane_coord> &due, projectiles &moving_objects,
+                      flow_field const &distances, pair<sig, sig> origin) {
+    auto &active_hazards = state.active_hazards;
+    state.timers.pop_due(active_hazards, state.tick, due);
+    trigger_primed_hazards(due, active_hazards, state.room, moving_objects,
+                           player, distances, origin);
+    for (auto &c : due) {
+        auto &a = *active_hazards.at(c).props;
+        if (a.behavior & hazard::behavior_bits::dissipate)
+            active_hazards.erase(c);
+        else
+            state.timers.schedule(active_hazards, c,
+                                  state.tick + to_ticks(a.activation_time));
+    }
+}
+void fire_due_hazards(room_state &state, specimen const &player,
+                      vector<plane_coord> &due) {
+    fire_due_hazards(state, player, due, state.moving_objects,
+                     state.distances, {0, 0});
+}
+
+/// Approximate heap footprint, used as the room cache cost.
+size_t memory_footprint(room_state const &state) {
+    auto r = sizeof(state);
+    for (auto &grid : state.room)
+        r += size_t(grid.stride() * grid.size()) +
+             size_t(grid.size() * grid.size()) / 8;
+    r += state.active_hazards.memory_footprint();
+    r += state.moving_objects.capacity_bytes();
+    r += state.timers.size() * sizeof(pair<sig, plane_coord>);
+    r += state.distances.memory_footprint();
+    return r;
+}
@@ -34,14 +34,55 @@ struct tile {
         propelled_bomb,
         blazing_fire,
     };
+    static constexpr auto ident_count = size_t(idents::blazing_fire) + 1;
     char symbol;
     sig flags;
-    string description;
     pair<SDL_Color, SDL_Color> color = color_idents::WHITE_ON_BLACK;
     sig attr = attr_bits::none;
 };
 
-vector<pair<tile::idents, double>> const ROOM_TILE_WEIGHTS = {
+/**
+ * Dense table of tile properties, indexed directly by tile::idents.
+ * Descriptions are kept apart so that a tile stays a small trivially
+ * copyable record.
+ */
+class tile_table {
+    array<tile, tile::ident_count> tiles_{};
+    array<char const *, tile::ident_count> descriptions_{};
+    array<bool, tile::ident_count> defined_{};
+
+  public:
+    struct entry {
+        tile::idents ident;
+        tile props;
+        char const *description = "";
+    };
+    constexpr tile_table(initializer_list<entry> entries) {
+        for (auto &e : entries) {
+            auto i = size_t(e.ident);
+            // pair::operator= is not constexpr before C++20
+            tiles_[i].symbol = e.props.symbol;
+            tiles_[i].flags = e.props.flags;
+            tiles_[i].color.first = e.props.color.first;
+            tiles_[i].color.second = e.props.color.second;
+            tiles_[i].attr = e.props.attr;
+            descriptions_[i] = e.description;
+            defined_[i] = true;
+        }
+    }
+    constexpr bool contains(tile::idents t) const {
+        return defined_[size_t(t)];
+    }
+    constexpr tile const &operator[](tile::idents t) const {
+        return tiles_[size_t(t)];
+    }
+    /// Empty for tiles that are not in the table.
+    string description(tile::idents t) const {
+        return defined_[size_t(t)] ? descriptions_[size_t(t)] : "";
+    }
+};
+
+constexpr array<pair<tile::idents, double>, 7> ROOM_TILE_WEIGHTS = {{
     {tile::idents::stone_rubble_pile, 60},
     {tile::idents::stone_flooring, 100},
     {tile::idents::cracked_stone_flooring, 40},
@@ -49,124 +90,61 @@ vector<pair<tile::idents, double>> const ROOM_TILE_WEIGHTS = {
     {tile::idents::stone_pillar, 2},
     {tile::idents::dart_trap, 2},
     {tile::idents::bomb_trap, 2},
-};
+}};
+/// Draws from ROOM_TILE_WEIGHTS; built at compile time.
+constexpr auto ROOM_TILE_SAMPLER = alias_table(ROOM_TILE_WEIGHTS);
 
-map<tile::idents, tile> const ALL_TILES = {
+constexpr tile_table ALL_TILES = {
     {tile::idents::stone_rubble_pile,
-     {
-         '"',
-         tile::flag_bits::passable,
-         "small pile of rubble",
-     }},
+     {'"', tile::flag_bits::passable},
+     "small pile of rubble"},
     {tile::idents::stone_flooring,
-     {
-         '.',
-         tile::flag_bits::passable,
-         "stone floor",
-     }},
+     {'.', tile::flag_bits::passable},
+     "stone floor"},
     {tile::idents::cracked_stone_flooring,
-     {
-         ',',
-         tile::flag_bits::passable,
-         "cracked stone floor",
-     }},
+     {',', tile::flag_bits::passable},
+     "cracked stone floor"},
     {tile::idents::decorated_stone_flooring,
-     {
-         '~',
-         tile::flag_bits::passable,
-         "decorated stone floor",
-     }},
+     {'~', tile::flag_bits::passable},
+     "decorated stone floor"},
     {tile::idents::burned_rubble_pile,
-     {
-         '"',
-         tile::flag_bits::passable,
-         "burned stone pile",
-         color_idents::GRAY_ON_BLACK,
-     }},
+     {'"', tile::flag_bits::passable, color_idents::GRAY_ON_BLACK},
+     "burned stone pile"},
     {tile::idents::burned_rubble_piece,
-     {
-         '\'',
-         tile::flag_bits::passable,
-         "burned piece of rubble",
-     }},
+     {'\'', tile::flag_bits::passable},
+     "burned piece of rubble"},
     {tile::idents::stone_pillar,
-     {
-         'O',
-         tile::flag_bits::none,
-         "stone pillar",
-         color_idents::CYAN_ON_BLACK,
-     }},
+     {'O', tile::flag_bits::none, color_idents::CYAN_ON_BLACK},
+     "stone pillar"},
     {tile::idents::wall,
-     {
-         '#',
-         tile::flag_bits::none,
-     }},
+     {'#', tile::flag_bits::none}},
     {tile::idents::doorway,
-     {
-         ' ',
-         tile::flag_bits::passable | tile::flag_bits::transporting,
-     }},
+     {' ', tile::flag_bits::passable | tile::flag_bits::transporting}},
     {tile::idents::doorway_sigil,
-     {
-         'D',
-         tile::flag_bits::passable | tile::flag_bits::shape_changing,
-         "",
-         color_idents::RED_ON_BLACK,
-     }},
+     {'D', tile::flag_bits::passable | tile::flag_bits::shape_changing,
+      color_idents::RED_ON_BLACK}},
     {tile::idents::dart_trap,
-     {
-         '#',
-         tile::flag_bits::none,
-         "A devious trap",
-         color_idents::WHITE_ON_BLACK,
-     }},
+     {'#', tile::flag_bits::none, color_idents::WHITE_ON_BLACK},
+     "A devious trap"},
     {tile::idents::bomb_trap,
-     {
-         '#',
-         tile::flag_bits::none,
-         "A devious trap",
-         color_idents::GRAY_ON_BLACK,
-     }},
+     {'#', tile::flag_bits::none, color_idents::GRAY_ON_BLACK},
+     "A devious trap"},
     {tile::idents::sliding_door,
-     {
-         '#',
-         tile::flag_bits::interactable,
-         "sliding door",
-         color_idents::RED_ON_BLACK,
-     }},
+     {'#', tile::flag_bits::interactable, color_idents::RED_ON_BLACK},
+     "sliding door"},
     {tile::idents::chest,
-     {
-         '?',
-         tile::flag_bits::interactable,
-         "mysterious chest",
-         color_idents::MAGENTA_ON_BLUE,
-     }},
+     {'?', tile::flag_bits::interactable, color_idents::MAGENTA_ON_BLUE},
+     "mysterious chest"},
     {tile::idents::player,
-     {
-         '*',
-         tile::flag_bits::none,
-         "Player character",
-         color_idents::GREEN_ON_WHITE,
-     }},
+     {'*', tile::flag_bits::none, color_idents::GREEN_ON_WHITE},
+     "Player character"},
     {tile::idents::propelled_dart,
-     {
-         '`',
-         tile::flag_bits::damaging,
-         "Shot by dart traps",
-         color_idents::RED_ON_BLACK,
-     }},
+     {'`', tile::flag_bits::damaging, color_idents::RED_ON_BLACK},
+     "Shot by dart traps"},
     {tile::idents::propelled_bomb,
-     {
-         '@',
-         tile::flag_bits::damaging,
-         "Lobbed by bomb traps",
-         color_idents::GRAY_ON_BLACK,
-     }},
+     {'@', tile::flag_bits::damaging, color_idents::GRAY_ON_BLACK},
+     "Lobbed by bomb traps"},
     {tile::idents::blazing_fire,
-     {
-         '~',
-         tile::flag_bits::damaging,
-         "Fire produced by explosions",
-         color_idents::ORANGE_ON_BLACK,
-     }},
+     {'~', tile::flag_bits::damaging, color_idents::ORANGE_ON_BLACK},
+     "Fire produced by explosions"},
 };
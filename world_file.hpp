@@ -0,0 +1,277 @@
+#pragma once
+#include <_main.hpp>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "coord.hpp"
+#include "grid.hpp"
+
+/**
+ * Binary world save, laid out so that it can be mmap'ed and read in place:
+ *
+ *      world_header
+ *      world_room_entry[room_count]    sorted by room id
+ *      world_door[...]                 doors of all rooms, grouped by room
+ *      tile blocks                     one per room, 64-byte aligned
+ *
+ * A tile block holds every layer of a room as row-major tile idents, one
+ * byte per cell. Each room carries an FNV-1a checksum over its index entry
+ * (up to the checksum itself), doors and tiles. All integers are stored in
+ * native byte order.
+ */
+struct world_header {
+    static constexpr char MAGIC[8] = "PGWORLD";
+    static constexpr uint32_t VERSION = 1;
+    char magic[8];
+    uint32_t version;
+    uint32_t room_count;
+    uint64_t seed;
+    int64_t current_room;
+    int64_t previous_room; // -1 if there is none
+    int64_t next_free_room;
+    int64_t life_points;
+    uint64_t index_offset, doors_offset;
+};
+
+struct world_room_entry {
+    /// terrain, player and projectiles
+    static constexpr int64_t LAYER_COUNT = 3;
+    int64_t id;
+    int64_t size, layer_count;
+    uint64_t tiles_offset;
+    uint64_t first_door;
+    uint32_t door_count;
+    uint32_t checksum;
+};
+
+struct world_door {
+    int64_t x, y;
+    int64_t target;
+    int64_t entrance; // 1 for the door the room was first entered through
+};
+
+static_assert(sizeof(tile::idents) == 1);
+static_assert(sizeof(world_header) == 72);
+static_assert(sizeof(world_room_entry) == 48);
+static_assert(sizeof(world_door) == 32);
+
+uint32_t fnv1a(void const *data, size_t n, uint32_t hash = 2166136261u) {
+    auto *bytes = static_cast<unsigned char const *>(data);
+    for (size_t i = 0; i < n; i++)
+        hash = (hash ^ bytes[i]) * 16777619u;
+    return hash;
+}
+
+/// Checksum of a room's index entry and doors; its tiles are hashed on top.
+uint32_t entry_checksum(world_room_entry const &e, world_door const *doors) {
+    return fnv1a(doors, e.door_count * sizeof(world_door),
+                 fnv1a(&e, offsetof(world_room_entry, checksum)));
+}
+
+/// Read-only view of a world save. Rooms are only paged in when loaded.
+class world_file {
+    void *data_ = MAP_FAILED;
+    size_t size_ = 0;
+    world_header const *header_ = nullptr;
+    world_room_entry const *index_ = nullptr;
+    world_door const *doors_ = nullptr;
+    uint64_t door_count_ = 0;
+    bool exists_ = false;
+
+    template <class T> T const *at(uint64_t offset, uint64_t count) const {
+        if (offset > size_ || count > (size_ - offset) / sizeof(T))
+            return nullptr;
+        return reinterpret_cast<T const *>(static_cast<char const *>(data_) +
+                                           offset);
+    }
+
+    world_room_entry const *find(sig id) const {
+        auto *last = index_ + header_->room_count;
+        auto *it = lower_bound(index_, last, id, [](auto &e, sig id) {
+            return e.id < id;
+        });
+        return it != last && it->id == id ? it : nullptr;
+    }
+
+    /// Whether the entry's sizes and door range fit the file. The tiles are
+    /// only checked when the room is loaded.
+    bool valid(world_room_entry const &e) const {
+        if (e.size <= 0 || e.layer_count != world_room_entry::LAYER_COUNT ||
+            e.first_door > door_count_ ||
+            e.door_count > door_count_ - e.first_door)
+            return false;
+        auto size = uint64_t(e.size);
+        return size <= size_ / size &&
+               uint64_t(e.layer_count) <= size_ / (size * size);
+    }
+
+  public:
+    explicit world_file(string const &path) {
+        auto fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return;
+        exists_ = true;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            size_ = size_t(st.st_size);
+            data_ = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        close(fd);
+        if (data_ == MAP_FAILED)
+            return;
+        auto *header = at<world_header>(0, 1);
+        if (!header || memcmp(header->magic, world_header::MAGIC, 8) ||
+            header->version != world_header::VERSION) {
+            cerr << path << ": not a world save of version "
+                 << world_header::VERSION << "\n";
+            return;
+        }
+        index_ = at<world_room_entry>(header->index_offset, header->room_count);
+        if (!index_)
+            return;
+        for (auto i : nums(0_s, size_t(header->room_count)))
+            door_count_ += index_[i].door_count;
+        doors_ = at<world_door>(header->doors_offset, door_count_);
+        if (doors_)
+            header_ = header;
+    }
+    ~world_file() {
+        if (data_ != MAP_FAILED)
+            munmap(data_, size_);
+    }
+    world_file(world_file const &) = delete;
+    world_file &operator=(world_file const &) = delete;
+
+    /// Whether there is a file at the path, be it a world save or not.
+    bool exists() const { return exists_; }
+    bool ok() const { return header_; }
+    world_header const &header() const { return *header_; }
+
+    /// The doors of every room. Rooms with an invalid entry are left out,
+    /// like corrupt rooms they are generated anew.
+    map<sig, map<plane_coord, sig>> room_network() const {
+        map<sig, map<plane_coord, sig>> r;
+        for (auto *e = index_; e != index_ + header_->room_count; ++e) {
+            if (!valid(*e))
+                continue;
+            auto &doors = r[e->id];
+            for (auto *d = doors_ + e->first_door;
+                 d != doors_ + e->first_door + e->door_count; ++d)
+                doors[{d->x, d->y, e->size - 1, 0}] = d->target;
+        }
+        return r;
+    }
+
+    map<sig, plane_coord> entrances() const {
+        map<sig, plane_coord> r;
+        for (auto *e = index_; e != index_ + header_->room_count; ++e) {
+            if (!valid(*e))
+                continue;
+            for (auto *d = doors_ + e->first_door;
+                 d != doors_ + e->first_door + e->door_count; ++d)
+                if (d->entrance)
+                    r.emplace(e->id, plane_coord(d->x, d->y, e->size - 1, 0));
+        }
+        return r;
+    }
+
+    /// Returns the room's layers, or nothing if it is missing or corrupt.
+    optional<layers> load_room(sig id) const {
+        auto *e = find(id);
+        if (!e)
+            return {};
+        auto cells = uint64_t(e->size) * uint64_t(e->size);
+        auto total = cells * uint64_t(e->layer_count);
+        auto *tiles =
+            valid(*e) ? at<tile::idents>(e->tiles_offset, total) : nullptr;
+        if (!tiles ||
+            fnv1a(tiles, total, entry_checksum(*e, doors_ + e->first_door)) !=
+                e->checksum) {
+            cerr << "world save: room " << id << " is corrupt\n";
+            return {};
+        }
+        layers r;
+        for (auto l : nums(0_s, size_t(e->layer_count))) {
+            r.push_back(grid(e->size));
+            for (sig y = 0; y < e->size; y++)
+                memcpy(r.back().raw_row(y).data(),
+                       tiles + l * cells + uint64_t(y * e->size),
+                       size_t(e->size));
+        }
+        return r;
+    }
+};
+
+/**
+ * Writes a world save. `room_layers` is called once for every room in the
+ * network. The file is written next to `path` and then renamed over it, so
+ * an open world_file of the same path stays valid.
+ */
+bool save_world(string const &path, world_header header,
+                map<sig, map<plane_coord, sig>> const &room_network,
+                map<sig, plane_coord> const &entrances,
+                function<layers(sig)> const &room_layers) {
+    auto align = [](uint64_t x) { return (x + 63) / 64 * 64; };
+    vector<world_room_entry> index;
+    vector<world_door> doors;
+    vector<layers> rooms;
+    auto tiles_offset = uint64_t(0);
+    for (auto &[id, room_doors] : room_network) {
+        rooms.push_back(room_layers(id));
+        auto &room = rooms.back();
+        auto first_door = doors.size();
+        for (auto &[c, target] : room_doors) {
+            auto entrance = entrances.count(id) && entrances.at(id) == c;
+            doors.push_back({c.x(), c.y(), target, entrance});
+        }
+        auto size = room.at(0).size();
+        index.push_back({id, size, sig(room.size()), tiles_offset, first_door,
+                         uint32_t(room_doors.size()), 0});
+        tiles_offset =
+            align(tiles_offset + uint64_t(size * size) * room.size());
+    }
+
+    memcpy(header.magic, world_header::MAGIC, 8);
+    header.version = world_header::VERSION;
+    header.room_count = uint32_t(index.size());
+    header.index_offset = sizeof(world_header);
+    header.doors_offset =
+        header.index_offset + index.size() * sizeof(world_room_entry);
+    auto tiles_start =
+        align(header.doors_offset + doors.size() * sizeof(world_door));
+    for (auto i : nums(0_s, index.size())) {
+        auto &e = index[i];
+        e.tiles_offset += tiles_start;
+        e.checksum = entry_checksum(e, doors.data() + e.first_door);
+        for (auto &grid : rooms[i])
+            for (sig y = 0; y < grid.size(); y++)
+                e.checksum =
+                    fnv1a(grid.row(y).data(), size_t(grid.size()), e.checksum);
+    }
+
+    auto tmp_path = path + ".tmp";
+    ofstream o(tmp_path, ios::binary);
+    auto put = [&o](void const *data, size_t n) {
+        o.write(static_cast<char const *>(data), streamsize(n));
+    };
+    put(&header, sizeof(header));
+    put(index.data(), index.size() * sizeof(world_room_entry));
+    put(doors.data(), doors.size() * sizeof(world_door));
+    for (auto i : nums(0_s, rooms.size())) {
+        auto padding = index[i].tiles_offset - uint64_t(o.tellp());
+        o.write(string(padding, '\0').data(), streamsize(padding));
+        for (auto &grid : rooms[i])
+            for (sig y = 0; y < grid.size(); y++)
+                put(grid.row(y).data(), size_t(grid.size()));
+    }
+    o.close();
+    if (!o || rename(tmp_path.c_str(), path.c_str()) != 0) {
+        remove(tmp_path.c_str());
+        return false;
+    }
+    return true;
+}